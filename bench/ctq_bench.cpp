@@ -0,0 +1,431 @@
+#include <benchmark/benchmark.h>
+#include "ctq/arena_queue.h"
+#include "ctq/circular_buffer.h"
+#include "ctq/histogram.h"
+#include "ctq/local_batcher.h"
+#include "ctq/sequenced_ring.h"
+#include "ctq/task_queue.h"
+#if defined(__linux__)
+#include "ctq/durable_queue.h"
+#endif
+#include <vector>
+#include <list>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <filesystem>
+#include <span>
+
+// Run with --benchmark_format=json (or --benchmark_out=<file> --benchmark_out_format=json)
+// to get machine-readable results which can be compared across releases.
+
+namespace {
+
+constexpr size_t batch = 20'000;
+
+// max_elements argument: 0 selects an unbounded queue
+std::optional<size_t> bound(int64_t arg) {
+	if (arg == 0)
+		return std::nullopt;
+	return static_cast<size_t>(arg);
+}
+
+template<typename Container>
+std::optional<size_t> bound_for(int64_t arg) {
+	return bound(arg);
+}
+
+// circular_buffer always needs a capacity, "unbounded" is a buffer which never fills up
+template<>
+std::optional<size_t> bound_for<ctq::circular_buffer<int>>(int64_t arg) {
+	return arg == 0 ? batch : static_cast<size_t>(arg);
+}
+
+void wait_for(const std::atomic<size_t>& done, size_t expected) {
+	while (done.load(std::memory_order_acquire) < expected) {
+		std::this_thread::yield();
+	}
+}
+
+// push `items` values from `producers` threads, split evenly
+template<typename Push>
+void produce(size_t producers, size_t items, Push push) {
+	std::vector<std::jthread> threads;
+	threads.reserve(producers);
+	for (size_t p = 0; p < producers; ++p) {
+		threads.emplace_back([&push, n = items / producers]() {
+			for (size_t i = 0; i < n; ++i) {
+				push(static_cast<int>(i));
+			}
+		});
+	}
+}
+
+void set_throughput_counters(benchmark::State& state, size_t items) {
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * items));
+	state.counters["producers"] = static_cast<double>(state.range(0));
+	state.counters["workers"] = static_cast<double>(state.range(1));
+	state.counters["max_elements"] = static_cast<double>(state.range(2));
+}
+
+void set_latency_counters(benchmark::State& state, const ctq::histogram& h) {
+	state.counters["p50_ns"] = static_cast<double>(h.percentile(50));
+	state.counters["p99_ns"] = static_cast<double>(h.percentile(99));
+	state.counters["p999_ns"] = static_cast<double>(h.percentile(99.9));
+	state.counters["max_ns"] = static_cast<double>(h.max());
+}
+
+uint64_t now_ns() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+} // namespace
+
+// ============================================================================
+// Throughput: producers x workers x bound, for every container
+// ============================================================================
+
+template<typename Container>
+void BM_BasicTaskQueueThroughput(benchmark::State& state) {
+	const auto producers = static_cast<size_t>(state.range(0));
+	const auto workers = static_cast<size_t>(state.range(1));
+	const size_t items = batch / producers * producers;
+
+	std::atomic<size_t> done{0};
+	ctq::basic_task_queue<Container> queue(
+		[&done](int n) {
+			benchmark::DoNotOptimize(n);
+			done.fetch_add(1, std::memory_order_release);
+		},
+		bound_for<Container>(state.range(2)),
+		workers
+	);
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += items;
+		produce(producers, items, [&queue](int i) { queue.push(i); });
+		wait_for(done, expected);
+	}
+	set_throughput_counters(state, items);
+}
+
+void throughput_matrix(benchmark::internal::Benchmark* b) {
+	b->ArgNames({"producers", "workers", "max_elements"});
+	b->ArgsProduct({{1, 2, 4}, {1, 2, 4}, {0, 64, 1024}});
+	b->UseRealTime();
+}
+
+BENCHMARK_TEMPLATE(BM_BasicTaskQueueThroughput, std::vector<int>)->Apply(throughput_matrix);
+BENCHMARK_TEMPLATE(BM_BasicTaskQueueThroughput, std::list<int>)->Apply(throughput_matrix);
+BENCHMARK_TEMPLATE(BM_BasicTaskQueueThroughput, std::deque<int>)->Apply(throughput_matrix);
+BENCHMARK_TEMPLATE(BM_BasicTaskQueueThroughput, ctq::circular_buffer<int>)->Apply(throughput_matrix);
+
+// ============================================================================
+// Throughput: single type vs variant task_queue
+// ============================================================================
+
+void BM_TaskQueueSingleType(benchmark::State& state) {
+	const auto producers = static_cast<size_t>(state.range(0));
+	const size_t items = batch / producers * producers;
+
+	std::atomic<size_t> done{0};
+	ctq::task_queue<std::deque, int> queue(
+		[&done](int n) {
+			benchmark::DoNotOptimize(n);
+			done.fetch_add(1, std::memory_order_release);
+		},
+		bound(state.range(2)),
+		static_cast<size_t>(state.range(1))
+	);
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += items;
+		produce(producers, items, [&queue](int i) { queue.push(i); });
+		wait_for(done, expected);
+	}
+	set_throughput_counters(state, items);
+}
+
+template<template<typename... U> class Container>
+void BM_TaskQueueVariant(benchmark::State& state) {
+	const auto producers = static_cast<size_t>(state.range(0));
+	const size_t items = batch / producers * producers;
+
+	std::atomic<size_t> done{0};
+	ctq::task_queue<Container, int, double, std::string> queue(
+		{
+			[&done](int n) { benchmark::DoNotOptimize(n); done.fetch_add(1, std::memory_order_release); },
+			[&done](double d) { benchmark::DoNotOptimize(d); done.fetch_add(1, std::memory_order_release); },
+			[&done](std::string s) { benchmark::DoNotOptimize(s); done.fetch_add(1, std::memory_order_release); }
+		},
+		bound(state.range(2)),
+		static_cast<size_t>(state.range(1))
+	);
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += items;
+		// mix the alternatives, strings stay within SSO to measure the queue, not the allocator
+		produce(producers, items, [&queue](int i) {
+			switch (i % 3) {
+			case 0: queue.push(i); break;
+			case 1: queue.push(static_cast<double>(i)); break;
+			default: queue.emplace("short"); break;
+			}
+		});
+		wait_for(done, expected);
+	}
+	set_throughput_counters(state, items);
+}
+
+void task_queue_matrix(benchmark::internal::Benchmark* b) {
+	b->ArgNames({"producers", "workers", "max_elements"});
+	b->ArgsProduct({{1, 4}, {1, 4}, {0, 1024}});
+	b->UseRealTime();
+}
+
+BENCHMARK(BM_TaskQueueSingleType)->Apply(task_queue_matrix);
+BENCHMARK_TEMPLATE(BM_TaskQueueVariant, std::deque)->Apply(task_queue_matrix);
+BENCHMARK_TEMPLATE(BM_TaskQueueVariant, ctq::arena_queue)->Apply(task_queue_matrix);
+
+// ============================================================================
+// Small items: push per item vs thread-local batches
+// ============================================================================
+
+void BM_LocalBatcher(benchmark::State& state) {
+	const auto producers = static_cast<size_t>(state.range(0));
+	const auto batch_size = static_cast<size_t>(state.range(1));
+	const size_t items = batch / producers * producers;
+
+	std::atomic<size_t> done{0};
+	ctq::basic_task_queue<std::deque<int>> queue(
+		[&done](int n) {
+			benchmark::DoNotOptimize(n);
+			done.fetch_add(1, std::memory_order_release);
+		},
+		std::nullopt,
+		2
+	);
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += items;
+		std::vector<std::jthread> threads;
+		for (size_t p = 0; p < producers; ++p) {
+			threads.emplace_back([&queue, batch_size, n = items / producers]() {
+				if (batch_size <= 1) {
+					for (size_t i = 0; i < n; ++i)
+						queue.push(static_cast<int>(i));
+					return;
+				}
+				ctq::local_batcher local(queue, batch_size);
+				for (size_t i = 0; i < n; ++i)
+					local.push(static_cast<int>(i));
+			});
+		}
+		threads.clear();
+		wait_for(done, expected);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(expected));
+}
+
+BENCHMARK(BM_LocalBatcher)->ArgNames({"producers", "batch"})->ArgsProduct({{1, 4}, {1, 64}})->UseRealTime();
+
+// ============================================================================
+// Three stage pipeline: chained queues vs one sequenced_ring
+// ============================================================================
+
+void BM_PipelineChainedQueues(benchmark::State& state) {
+	const auto capacity = static_cast<size_t>(state.range(0));
+
+	std::atomic<size_t> done{0};
+	ctq::basic_task_queue<ctq::circular_buffer<int>> persist(
+		[&done](int n) { benchmark::DoNotOptimize(n); done.fetch_add(1, std::memory_order_release); }, capacity);
+	ctq::basic_task_queue<ctq::circular_buffer<int>> enrich([&persist](int n) { persist.push(n + 1); }, capacity);
+	ctq::basic_task_queue<ctq::circular_buffer<int>> parse([&enrich](int n) { enrich.push(n * 2); }, capacity);
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += batch;
+		for (size_t i = 0; i < batch; ++i)
+			parse.push(static_cast<int>(i));
+		wait_for(done, expected);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(expected));
+}
+
+void BM_PipelineSequencedRing(benchmark::State& state) {
+	const auto capacity = static_cast<size_t>(state.range(0));
+
+	std::atomic<size_t> done{0};
+	ctq::sequenced_ring<int> ring(capacity);
+	auto parse = ring.add_stage([](int& n) { n *= 2; });
+	auto enrich = ring.add_stage([](int& n) { n += 1; }, {parse});
+	ring.add_stage([&done](int& n) { benchmark::DoNotOptimize(n); done.fetch_add(1, std::memory_order_release); }, {enrich});
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += batch;
+		for (size_t i = 0; i < batch; ++i)
+			ring.push(static_cast<int>(i));
+		wait_for(done, expected);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(expected));
+}
+
+BENCHMARK(BM_PipelineChainedQueues)->ArgName("capacity")->Arg(64)->Arg(1024)->UseRealTime();
+BENCHMARK(BM_PipelineSequencedRing)->ArgName("capacity")->Arg(64)->Arg(1024)->UseRealTime();
+
+// ============================================================================
+// Monitoring: the cost a monitor polling the lock-free accessors puts on a running queue
+// ============================================================================
+
+// one producer and one worker while a monitor polls either the discard counters, on a line
+// written only when an item is dropped or fails (none is here), or the size and idle gauges,
+// on the line every push and pop stores the size into; on a multi-core machine the gap between
+// the two is the cost of the gauge line moving between the data path and the monitor
+enum class polled { none, counters, gauges };
+
+void BM_PolledQueue(benchmark::State& state) {
+	const auto mode = static_cast<polled>(state.range(0));
+
+	std::atomic<size_t> done{0};
+	ctq::basic_task_queue<std::deque<int>> queue(
+		[&done](int n) {
+			benchmark::DoNotOptimize(n);
+			done.fetch_add(1, std::memory_order_release);
+		},
+		std::nullopt
+	);
+
+	std::jthread monitor;
+	if (mode != polled::none) {
+		monitor = std::jthread([&queue, mode](std::stop_token st) {
+			while (!st.stop_requested()) {
+				if (mode == polled::counters) {
+					benchmark::DoNotOptimize(queue.dropped());
+					benchmark::DoNotOptimize(queue.failed());
+				} else {
+					benchmark::DoNotOptimize(queue.size_approx());
+					benchmark::DoNotOptimize(queue.idle_workers());
+				}
+			}
+		});
+	}
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		expected += batch;
+		for (size_t i = 0; i < batch; ++i)
+			queue.push(static_cast<int>(i));
+		wait_for(done, expected);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(expected));
+}
+
+BENCHMARK(BM_PolledQueue)->ArgName("polled")->Arg(0)->Arg(1)->Arg(2)->UseRealTime(); // none, counters, gauges
+
+// ============================================================================
+// Durable queue: syncs shared by concurrent producers (group commit) and batches
+// ============================================================================
+
+#if defined(__linux__)
+void BM_DurableQueue(benchmark::State& state) {
+	const auto producers = static_cast<size_t>(state.range(0));
+	const auto batch_size = static_cast<size_t>(state.range(1));
+	const size_t items = 2'000 / producers * producers;
+
+	auto dir = std::filesystem::temp_directory_path() / "ctq-bench-wal";
+	std::filesystem::remove_all(dir);
+	ctq::spill_codec<int> codec{
+		[](const int& n, std::vector<std::byte>& out) {
+			auto p = reinterpret_cast<const std::byte*>(&n);
+			out.insert(out.end(), p, p + sizeof(n));
+		},
+		[](std::span<const std::byte> in) {
+			int n;
+			std::memcpy(&n, in.data(), sizeof(n));
+			return n;
+		}
+	};
+
+	std::atomic<size_t> done{0};
+	size_t expected = 0;
+	{
+		ctq::durable_queue<int> queue(
+			[&done](int n) {
+				benchmark::DoNotOptimize(n);
+				done.fetch_add(1, std::memory_order_release);
+			},
+			dir, codec, std::nullopt, 2);
+
+		for (auto _ : state) {
+			expected += items;
+			std::vector<std::jthread> threads;
+			for (size_t p = 0; p < producers; ++p) {
+				threads.emplace_back([&queue, batch_size, n = items / producers]() {
+					std::vector<int> chunk;
+					for (size_t i = 0; i < n; ++i) {
+						chunk.push_back(static_cast<int>(i));
+						if (chunk.size() == batch_size || i + 1 == n) {
+							queue.push_batch(chunk.begin(), chunk.end());
+							chunk.clear();
+						}
+					}
+				});
+			}
+			threads.clear();
+			wait_for(done, expected);
+		}
+	}
+	std::filesystem::remove_all(dir);
+	state.SetItemsProcessed(static_cast<int64_t>(expected));
+}
+
+BENCHMARK(BM_DurableQueue)->ArgNames({"producers", "batch"})->ArgsProduct({{1, 8}, {1, 64}})->UseRealTime();
+#endif
+
+// ============================================================================
+// End-to-end latency: push to callback entry
+// ============================================================================
+
+template<typename Container>
+void BM_EnqueueToCallbackLatency(benchmark::State& state) {
+	const auto workers = static_cast<size_t>(state.range(0));
+
+	ctq::histogram_recorder latency;
+	std::atomic<size_t> done{0};
+	ctq::basic_task_queue<Container> queue(
+		[&](uint64_t pushed) {
+			latency.record(now_ns() - pushed);
+			done.fetch_add(1, std::memory_order_release);
+		},
+		1024,
+		workers
+	);
+
+	size_t expected = 0;
+	for (auto _ : state) {
+		// paced pushes, so that the latency is not dominated by the backlog
+		for (size_t i = 0; i < 1000; ++i) {
+			queue.push(now_ns());
+			++expected;
+			if (i % 10 == 0)
+				wait_for(done, expected);
+		}
+		wait_for(done, expected);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(expected));
+	set_latency_counters(state, latency.snapshot());
+}
+
+BENCHMARK_TEMPLATE(BM_EnqueueToCallbackLatency, std::deque<uint64_t>)->ArgName("workers")->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_EnqueueToCallbackLatency, ctq::circular_buffer<uint64_t>)->ArgName("workers")->Arg(1)->Arg(4)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace ctq {
+
+template<typename T>
+struct arena_queue;
+
+/** @brief FIFO of std::variant<Ts...> storing every item with the size of its own alternative
+ *
+ * A std::deque<std::variant<Ts...>> spends sizeof the largest alternative on every item, and
+ * a std::string alternative keeps its characters in a separate heap block. arena_queue packs
+ * the items into one contiguous byte ring instead: each record is an 8 byte header (type tag
+ * and payload length) followed by the alternative itself, rounded up to the record alignment.
+ * std::string alternatives are stored as their characters, inline in the record, and turned
+ * back into a std::string when the item is taken.
+ *
+ * The ring grows (doubling) when a record does not fit, relocating the queued records by
+ * move construction; it never shrinks. Use as the container of a variant task queue:
+ * ctq::task_queue<ctq::arena_queue, int, std::string, big_struct>.
+ *
+ * Items are taken with next(), which moves the item out and pops it, the way the queue does.
+ * front() returns a copy.
+ *
+ * @tparam Ts The alternatives, move constructible, at most 65535 of them.
+ */
+template<typename... Ts>
+struct arena_queue<std::variant<Ts...>> {
+	using value_type = std::variant<Ts...>;
+
+	static constexpr size_t alignment = std::max({size_t{8}, alignof(Ts)...});
+
+	explicit arena_queue(size_t initial_bytes = 4096)
+		: cap_(round_up(std::max(initial_bytes, alignment)))
+		  ,buf_(allocate(cap_))
+	{ }
+
+	arena_queue(const arena_queue&) = delete;
+	arena_queue& operator=(const arena_queue&) = delete;
+
+	~arena_queue() {
+		clear();
+		deallocate(buf_);
+	}
+
+	void push_back(value_type&& v) {
+		std::visit([this](auto&& x) { put(std::move(x)); }, std::move(v));
+	}
+
+	// an argument which is one of the alternatives is stored directly, without a variant
+	template<typename... Args>
+	void emplace_back(Args&&... args) {
+		if constexpr (sizeof...(Args) == 1 && (is_alternative<std::decay_t<Args>> && ...)) {
+			put(std::forward<Args>(args)...);
+		} else {
+			push_back(value_type(std::forward<Args>(args)...));
+		}
+	}
+
+	// return and pop
+	value_type next() {
+		assert(count_ > 0);
+		auto h = header_at(head_);
+		auto v = ops[h.tag].take(buf_ + head_ + ops[h.tag].offset, h.payload);
+		pop_front();
+		return v;
+	}
+
+	value_type front() const requires (std::is_copy_constructible_v<Ts> && ...) {
+		assert(count_ > 0);
+		auto h = header_at(head_);
+		return ops[h.tag].copy(buf_ + head_ + ops[h.tag].offset, h.payload);
+	}
+
+	void pop_front() {
+		assert(count_ > 0);
+		auto h = header_at(head_);
+		ops[h.tag].destroy(buf_ + head_ + ops[h.tag].offset);
+		auto n = record_size(h);
+		used_ -= n;
+		head_ += n;
+		if (--count_ == 0) {
+			head_ = tail_ = used_ = 0;
+			return;
+		}
+		if (head_ == cap_)
+			head_ = 0;
+		skip_wrap();
+	}
+
+	size_t size() const {
+		return count_;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+
+	// bytes taken by the queued records, including padding at the end of the ring
+	size_t bytes_used() const {
+		return used_;
+	}
+
+	size_t capacity_bytes() const {
+		return cap_;
+	}
+
+	void clear() {
+		while (count_ > 0)
+			pop_front();
+	}
+
+private:
+	struct header {
+		uint32_t payload; // length of the alternative in bytes
+		uint16_t tag;     // index of the alternative, wrap_tag for the padding at the end of the ring
+		uint16_t unused;
+	};
+	static_assert(sizeof(header) == 8);
+	static_assert(sizeof...(Ts) < 0xffff);
+
+	static constexpr uint16_t wrap_tag = 0xffff;
+
+	template<typename T>
+	static constexpr bool is_alternative = (std::is_same_v<T, Ts> || ...);
+
+	template<typename T>
+	static constexpr bool is_string = std::is_same_v<T, std::string>;
+
+	// what the ring needs to know about alternative T, picked by the tag at run time
+	struct type_ops {
+		size_t offset; // of the payload in the record
+		void (*destroy)(std::byte* p);
+		void (*relocate)(std::byte* from, std::byte* to, uint32_t payload);
+		value_type (*take)(std::byte* p, uint32_t payload);
+		value_type (*copy)(const std::byte* p, uint32_t payload);
+	};
+
+	template<typename T>
+	static constexpr type_ops ops_of() {
+		type_ops o{};
+		o.offset = (sizeof(header) + alignof(T) - 1) / alignof(T) * alignof(T);
+		if constexpr (is_string<T>) {
+			o.offset = sizeof(header);
+			o.destroy = [](std::byte*) {};
+			o.relocate = [](std::byte* from, std::byte* to, uint32_t n) { std::memcpy(to, from, n); };
+			o.take = [](std::byte* p, uint32_t n) {
+				return value_type(std::in_place_type<std::string>, reinterpret_cast<const char*>(p), n);
+			};
+			o.copy = [](const std::byte* p, uint32_t n) {
+				return value_type(std::in_place_type<std::string>, reinterpret_cast<const char*>(p), n);
+			};
+		} else {
+			o.destroy = [](std::byte* p) { std::launder(reinterpret_cast<T*>(p))->~T(); };
+			o.relocate = [](std::byte* from, std::byte* to, uint32_t) {
+				auto src = std::launder(reinterpret_cast<T*>(from));
+				new (to) T(std::move(*src));
+				src->~T();
+			};
+			o.take = [](std::byte* p, uint32_t) {
+				return value_type(std::in_place_type<T>, std::move(*std::launder(reinterpret_cast<T*>(p))));
+			};
+			if constexpr (std::is_copy_constructible_v<T>) {
+				o.copy = [](const std::byte* p, uint32_t) {
+					return value_type(std::in_place_type<T>, *std::launder(reinterpret_cast<const T*>(p)));
+				};
+			}
+		}
+		return o;
+	}
+
+	static constexpr std::array<type_ops, sizeof...(Ts)> ops{ops_of<Ts>()...};
+
+	static constexpr size_t round_up(size_t n) {
+		return (n + alignment - 1) / alignment * alignment;
+	}
+
+	static size_t record_size(header h) {
+		return round_up(ops[h.tag].offset + h.payload);
+	}
+
+	static std::byte* allocate(size_t n) {
+		return static_cast<std::byte*>(::operator new(n, std::align_val_t(alignment)));
+	}
+
+	static void deallocate(std::byte* p) {
+		::operator delete(p, std::align_val_t(alignment));
+	}
+
+	header header_at(size_t offset) const {
+		header h;
+		std::memcpy(&h, buf_ + offset, sizeof(h));
+		return h;
+	}
+
+	void write_header(size_t offset, uint16_t tag, uint32_t payload) {
+		header h{payload, tag, 0};
+		std::memcpy(buf_ + offset, &h, sizeof(h));
+	}
+
+	void skip_wrap() {
+		if (header_at(head_).tag == wrap_tag) {
+			used_ -= cap_ - head_;
+			head_ = 0;
+		}
+	}
+
+	template<typename T>
+	void put(T&& v) {
+		using U = std::decay_t<T>;
+		constexpr auto tag = static_cast<uint16_t>(index_of<U>());
+		uint32_t payload;
+		if constexpr (is_string<U>) {
+			payload = static_cast<uint32_t>(v.size());
+		} else {
+			payload = sizeof(U);
+		}
+		header h{payload, tag, 0};
+		auto n = record_size(h);
+		auto at = place(n);
+		auto p = buf_ + at + ops[tag].offset;
+		if constexpr (is_string<U>) {
+			std::memcpy(p, v.data(), payload);
+		} else {
+			new (p) U(std::forward<T>(v));
+		}
+		write_header(at, tag, payload);
+		++count_;
+	}
+
+	template<typename T>
+	static constexpr size_t index_of() {
+		size_t i = 0;
+		((std::is_same_v<T, Ts> ? false : (++i, true)) && ...);
+		return i;
+	}
+
+	// find room for a record of n bytes, returns its offset
+	size_t place(size_t n) {
+		if (count_ > 0 && tail_ <= head_) {
+			// wrapped: the free space is between tail and head
+			if (head_ - tail_ < n)
+				grow(n);
+		} else if (cap_ - tail_ < n) {
+			// at the end of the ring, continue at the start if there is room before head
+			if (count_ > 0 && head_ >= n) {
+				write_header(tail_, wrap_tag, 0);
+				used_ += cap_ - tail_;
+				tail_ = 0;
+			} else {
+				grow(n);
+			}
+		}
+		auto at = tail_;
+		tail_ += n;
+		used_ += n;
+		if (tail_ == cap_)
+			tail_ = 0;
+		return at;
+	}
+
+	// move the records, in order, to the start of a larger ring with room for n more bytes
+	void grow(size_t n) {
+		auto cap = std::max(cap_ * 2, round_up(used_ + n));
+		auto buf = allocate(cap);
+		size_t out = 0;
+		auto remaining = count_;
+		auto in = head_;
+		while (remaining > 0) {
+			auto h = header_at(in);
+			if (h.tag == wrap_tag) {
+				in = 0;
+				continue;
+			}
+			auto size = record_size(h);
+			auto offset = ops[h.tag].offset;
+			std::memcpy(buf + out, &h, sizeof(h));
+			ops[h.tag].relocate(buf_ + in + offset, buf + out + offset, h.payload);
+			out += size;
+			in += size;
+			if (in == cap_)
+				in = 0;
+			--remaining;
+		}
+		deallocate(buf_);
+		buf_ = buf;
+		cap_ = cap;
+		head_ = 0;
+		tail_ = out;
+		used_ = out;
+	}
+
+	size_t cap_;
+	std::byte* buf_;
+	size_t head_{};  // offset of the oldest record
+	size_t tail_{};  // offset of the next record
+	size_t used_{};
+	size_t count_{};
+};
+
+} // namespace ctq
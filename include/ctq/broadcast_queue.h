@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ctq {
+
+/** @brief Publish/subscribe queue: every item is processed by every subscriber
+ *
+ * Items are stored once, in a ring of capacity slots, and each subscriber reads them in
+ * place through its own cursor (sequence number), from its own thread, as in the LMAX
+ * Disruptor. A slot is reused only once the slowest subscriber has passed it: push() blocks
+ * while the ring holds capacity items not yet seen by every subscriber, so a slow
+ * subscriber applies backpressure instead of being skipped.
+ *
+ * A subscriber takes all the items published since its last turn as one batch and releases
+ * their slots once the batch is done. It sees the items published after it subscribed.
+ * Without subscribers items are discarded. As for basic_task_queue, an exception escaping
+ * a callback terminates the process.
+ *
+ * Example:
+ *   ctq::broadcast_queue<quote> topic(1024);
+ *   topic.subscribe([](const quote& q) { update_book(q); });
+ *   topic.subscribe([](const quote& q) { log(q); });
+ *   topic.push(q); // seen by both, not copied
+ *
+ * @tparam T The item type, default constructible and move assignable.
+ */
+template<typename T>
+struct broadcast_queue {
+	using type = T;
+	using callback = std::function<void(const T&)>;
+
+	/** @param capacity The number of slots, i.e. how far the fastest subscriber can run ahead of the slowest. */
+	explicit broadcast_queue(size_t capacity)
+		: ring_(capacity)
+	{ }
+
+	broadcast_queue(const broadcast_queue&) = delete;
+	broadcast_queue& operator=(const broadcast_queue&) = delete;
+
+	~broadcast_queue() {
+		for (auto& s : subscribers_)
+			s.thread.request_stop();
+		for (auto& s : subscribers_)
+			s.thread.join();
+	}
+
+	/** @brief Add a subscriber running cb on a thread of its own
+	 *
+	 * @return An id for unsubscribe().
+	 */
+	size_t subscribe(callback cb) {
+		std::unique_lock lock(mutex_);
+		auto& s = subscribers_.emplace_back();
+		s.id = next_id_++;
+		s.cb = std::move(cb);
+		s.cursor = head_;
+		s.thread = std::jthread([this, &s](std::stop_token st) { work(st, s); });
+		return s.id;
+	}
+
+	/** @brief Remove a subscriber, waits for its current batch to finish
+	 *
+	 * Must not be called from a callback of this queue.
+	 */
+	void unsubscribe(size_t id) {
+		typename std::list<subscriber>::iterator it;
+		{
+			std::unique_lock lock(mutex_);
+			it = std::find_if(subscribers_.begin(), subscribers_.end(), [id](auto& s) { return s.id == id; });
+			if (it == subscribers_.end())
+				return;
+			it->thread.request_stop();
+		}
+		it->thread.join(); // the slots it reads stay reserved until then
+		{
+			std::unique_lock lock(mutex_);
+			subscribers_.erase(it);
+		}
+		room_.notify_all();
+	}
+
+	/** @brief Publish an item to every subscriber, blocks while the slowest one is capacity items behind */
+	void push(T item) {
+		{
+			std::unique_lock lock(mutex_);
+			room_.wait(lock, [this]() { return head_ - tail_locked() < ring_.size(); });
+			ring_[head_ % ring_.size()] = std::move(item);
+			++head_;
+		}
+		cv_.notify_all();
+	}
+
+	/** @brief Same as push but constructs the item from args */
+	template<typename... Args>
+	void emplace(Args&&... args) {
+		push(T(std::forward<Args>(args)...));
+	}
+
+	/** @brief Items not yet processed by the slowest subscriber */
+	size_t size() const {
+		std::unique_lock lock(mutex_);
+		return head_ - tail_locked();
+	}
+
+	size_t subscribers() const {
+		std::unique_lock lock(mutex_);
+		return subscribers_.size();
+	}
+
+private:
+	struct subscriber {
+		size_t id{};
+		callback cb;
+		uint64_t cursor{}; // next sequence number to read
+		std::jthread thread;
+	};
+
+	// lowest cursor: slots from there on are still being read
+	uint64_t tail_locked() const {
+		uint64_t tail = head_;
+		for (auto& s : subscribers_)
+			tail = std::min(tail, s.cursor);
+		return tail;
+	}
+
+	void work(std::stop_token st, subscriber& s) {
+		while (true) {
+			uint64_t from, to;
+			{
+				std::unique_lock lock(mutex_);
+				cv_.wait(lock, st, [this, &s]() { return s.cursor < head_; });
+				if (st.stop_requested())
+					return; // unsubscribed, possibly with items left
+				from = s.cursor;
+				to = head_;
+			}
+			// the slots [from, to) cannot be overwritten until the cursor moves past them
+			auto seq = from;
+			for (; seq < to && !st.stop_requested(); ++seq)
+				s.cb(ring_[seq % ring_.size()]);
+			{
+				std::unique_lock lock(mutex_);
+				s.cursor = seq;
+			}
+			room_.notify_all();
+		}
+	}
+
+	std::vector<T> ring_;
+	mutable std::mutex mutex_;
+	std::condition_variable_any cv_; // subscribers wait for items
+	std::condition_variable room_;   // producers wait for the slowest subscriber
+	uint64_t head_{}; // sequence number of the next item
+	size_t next_id_{};
+	std::list<subscriber> subscribers_; // stable addresses, used by the subscriber threads
+};
+
+} // namespace ctq
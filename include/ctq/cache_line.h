@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+namespace ctq {
+
+namespace detail {
+
+	/** @brief Size used to keep independently written data on separate cache lines
+	 *
+	 * A fixed value rather than std::hardware_destructive_interference_size: the latter
+	 * may change with compiler flags, which makes it unsuitable for the layout of types
+	 * in a header-only library.
+	 */
+inline constexpr size_t cache_line_size = 64;
+
+} // namespace detail
+
+} // namespace ctq
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
 #include <vector>
 #include <utility>
 
@@ -22,25 +24,22 @@ struct circular_buffer {
 	}
 
 	void push_back(T&& v) {
-		assert(cnt_ <= b_.size());
+		assert(cnt_ < b_.size());
 		assert(read_pnt_ < b_.size());
-		// next index
-		auto i = ( read_pnt_ + cnt_ ) % b_.size();
-		b_[i] = v;
+		b_[back_index()] = std::move(v);
 		++cnt_;
 	}
 
+	// the slots always hold live objects, the new element is assigned to the next one
 	template<typename... Args>
 	void emplace_back(Args&&... args) {
-		assert(cnt_ <= b_.size());
+		assert(cnt_ < b_.size());
 		assert(read_pnt_ < b_.size());
-		// next index
-		auto i = ( read_pnt_ + cnt_ ) % b_.size();
-		new (b_.data() + i) T(std::forward<Args>(args)...);
+		b_[back_index()] = T(std::forward<Args>(args)...);
 		++cnt_;
 	}
 
-	T front() {
+	T& front() {
 		assert(cnt_ > 0);
 		return b_[read_pnt_];
 	}
@@ -58,7 +57,7 @@ struct circular_buffer {
 		auto i = read_pnt_++;
 		if (read_pnt_ == b_.size())
 			read_pnt_ = 0;
-		return b_[i];
+		return std::move(b_[i]);
 	}
 
 	size_t size() const
@@ -66,6 +65,38 @@ struct circular_buffer {
 		return cnt_;
 	}
 
+	// i-th element from the front
+	T& operator[](size_t i) {
+		assert(i < cnt_);
+		return b_[(read_pnt_ + i) % b_.size()];
+	}
+
+	const T& operator[](size_t i) const {
+		assert(i < cnt_);
+		return b_[(read_pnt_ + i) % b_.size()];
+	}
+
+	// raw slot access, used by the queue to hand out slots for in-place writes and reads
+
+	size_t front_index() const {
+		return read_pnt_;
+	}
+
+	// slot written by the next push_back
+	size_t back_index() const {
+		return ( read_pnt_ + cnt_ ) % b_.size();
+	}
+
+	T& slot(size_t i) {
+		return b_[i];
+	}
+
+	// take the next slot as an element without writing it
+	void claim_back() {
+		assert(cnt_ < b_.size());
+		++cnt_;
+	}
+
 private:
 	std::vector<value_type> b_;
 	size_t cnt_{}; // number of element in the buffer
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <concepts>
+#include <coroutine>
+
+namespace ctq {
+
+/** @brief Scheduler interface used to resume coroutines suspended on a queue
+ *
+ * A scheduler is any object with schedule(std::coroutine_handle<>), which must eventually
+ * call resume() on the handle, e.g. by posting it to an event loop. It is called by the
+ * thread which made the awaited operation possible (a worker freeing a slot, a producer
+ * pushing an item), never with a queue lock held.
+ */
+template<typename S>
+concept scheduler = requires(S& s, std::coroutine_handle<> h) {
+	s.schedule(h);
+};
+
+/** @brief Scheduler resuming the coroutine immediately on the calling thread */
+struct inline_scheduler {
+	void schedule(std::coroutine_handle<> h) {
+		h.resume();
+	}
+};
+
+namespace detail {
+
+	// Type erased reference to a scheduler, which must outlive the suspension
+struct resumer {
+	void* scheduler = nullptr;
+	void (*schedule)(void*, std::coroutine_handle<>) = nullptr;
+
+	template<ctq::scheduler S>
+	static resumer of(S& s) {
+		return {&s, [](void* p, std::coroutine_handle<> h) { static_cast<S*>(p)->schedule(h); }};
+	}
+
+	void operator()(std::coroutine_handle<> h) const {
+		schedule(scheduler, h);
+	}
+};
+
+// A suspended coroutine ready to be handed to its scheduler
+struct resumption {
+	std::coroutine_handle<> handle;
+	resumer resume;
+};
+
+inline inline_scheduler default_scheduler;
+
+} // namespace detail
+
+} // namespace ctq
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if !defined(__linux__)
+#error "ctq: durable_queue.h requires Linux"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include <ctq/spill.h>
+#include <ctq/task_queue.h>
+
+namespace ctq {
+
+namespace detail {
+
+	/** @brief Write-ahead log: byte records numbered in append order, in memory-mapped segment files
+	 *
+	 * A record is written into the mapping of the newest segment, behind a header holding its
+	 * length, a checksum and its number, so appending makes no system call. sync() makes the
+	 * records durable by group commit: the first caller flushes the segments with fdatasync
+	 * for every record appended so far, the callers arriving meanwhile wait for it or for the
+	 * next round, so concurrent producers share the cost of a flush.
+	 *
+	 * ack() marks a record processed. The checkpoint, the number of the oldest record not
+	 * processed, is stored in a mapped file of its own, without a system call either: after a
+	 * crash it may be behind and some records are processed again, never skipped. Segments
+	 * entirely behind the checkpoint are deleted once it is flushed with fdatasync.
+	 *
+	 * On construction the segments found in the directory are scanned up to the first record
+	 * whose number or checksum does not match, i.e. a write torn by the crash. The log ends there:
+	 * the segments which do not follow on from the previous one without a gap, and those without
+	 * a valid record, e.g. one being created, were never synced and are deleted. replay() then
+	 * passes the records from the checkpoint on. New records go to a new segment.
+	 */
+struct write_ahead_log {
+	/**
+	 * @param dir Directory of the log, created if needed; one log per directory.
+	 * @param segment_size Size of a segment file, a larger record gets a segment of its own.
+	 * @throws std::system_error if the files cannot be opened or mapped.
+	 */
+	write_ahead_log(std::filesystem::path dir, size_t segment_size)
+		: dir_(std::move(dir))
+		  ,segment_size_(segment_size)
+	{
+		std::filesystem::create_directories(dir_);
+		open_checkpoint();
+		try {
+			std::vector<std::pair<uint64_t, std::filesystem::path>> found;
+			for (auto& e : std::filesystem::directory_iterator(dir_)) {
+				if (auto first = segment_number(e.path()))
+					found.emplace_back(*first, e.path());
+			}
+			std::sort(found.begin(), found.end());
+			bool ended = false;
+			for (auto& [first, path] : found) {
+				if (!ended && (segments_.empty() || first == segments_.back().end)) {
+					auto& s = segments_.emplace_back(map_existing(path, first));
+					while (auto r = valid_record(s, s.write, s.end)) {
+						s.write += header_size + r->size();
+						++s.end;
+					}
+					s.capacity = s.write; // sealed, new records go to a new segment; the mapping stays whole
+					if (s.end != s.first)
+						continue;
+					unmap(s);
+					segments_.pop_back();
+				}
+				// the end of the log: delete the rest, their names are taken by the next segments
+				ended = true;
+				std::error_code ec;
+				if (!std::filesystem::remove(path, ec) && ec)
+					throw std::system_error(ec, "ctq: write-ahead log segment");
+			}
+			if (ended)
+				sync_directory();
+		} catch (...) {
+			for (auto& s : segments_)
+				unmap(s);
+			close_checkpoint();
+			throw;
+		}
+		next_ = segments_.empty() ? checkpoint_ : segments_.back().end;
+		synced_ = next_;
+		// the checkpoint must number a record found, or the next one: ack() only moves it on
+		// from the record it numbers
+		if (!segments_.empty())
+			checkpoint_ = std::clamp(checkpoint_, segments_.front().first, next_);
+		std::memcpy(checkpoint_map_, &checkpoint_, sizeof(checkpoint_));
+		replay_from_ = checkpoint_;
+	}
+
+	write_ahead_log(const write_ahead_log&) = delete;
+	write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+	~write_ahead_log() {
+		for (auto& s : segments_) {
+			::fdatasync(s.fd);
+			unmap(s);
+		}
+		::fdatasync(checkpoint_fd_);
+		close_checkpoint();
+	}
+
+	/** @brief Append a record, not yet durable, and return its number
+	 *
+	 * @throws std::length_error if the record does not fit the 32-bit length of its header,
+	 * nothing is written then.
+	 */
+	uint64_t append(std::span<const std::byte> record) {
+		if (record.size() > UINT32_MAX)
+			throw std::length_error("ctq: write-ahead log record larger than 4 GiB");
+		std::unique_lock lock(mutex_);
+		auto need = header_size + record.size();
+		if (segments_.empty() || segments_.back().capacity - segments_.back().write < need)
+			segments_.push_back(map_new(next_, std::max(segment_size_, need)));
+		auto& s = segments_.back();
+		header h{static_cast<uint32_t>(record.size()), checksum(record), next_};
+		std::memcpy(s.data + s.write, &h, header_size);
+		std::memcpy(s.data + s.write + header_size, record.data(), record.size());
+		s.write += need;
+		s.end = ++next_;
+		return h.seq;
+	}
+
+	/** @brief Return once every record numbered below end is on disk
+	 *
+	 * @throws std::system_error if fdatasync fails, the records may not be durable then.
+	 */
+	void sync(uint64_t end) {
+		std::unique_lock lock(mutex_);
+		while (synced_ < end) {
+			if (syncing_) {
+				synced_cv_.wait(lock);
+				continue;
+			}
+			// lead this round: flush everything appended so far, for whoever is waiting
+			syncing_ = true;
+			auto target = next_;
+			std::vector<int> fds;
+			for (auto& s : segments_) {
+				if (s.end > synced_)
+					fds.push_back(s.fd); // not deleted meanwhile, the checkpoint stays below synced_
+			}
+			lock.unlock();
+			int err = 0;
+			for (int fd : fds) {
+				if (::fdatasync(fd) != 0)
+					err = errno;
+			}
+			lock.lock();
+			syncing_ = false;
+			if (err == 0)
+				synced_ = target;
+			synced_cv_.notify_all();
+			if (err != 0)
+				throw std::system_error(err, std::generic_category(), "ctq: write-ahead log sync");
+		}
+	}
+
+	/** @brief Mark the record numbered seq processed, in any order */
+	void ack(uint64_t seq) {
+		std::unique_lock lock(mutex_);
+		if (seq < checkpoint_)
+			return;
+		if (seq != checkpoint_) {
+			acked_.insert(seq);
+			return;
+		}
+		do {
+			++checkpoint_;
+		} while (acked_.erase(checkpoint_));
+		std::memcpy(checkpoint_map_, &checkpoint_, sizeof(checkpoint_));
+		if (!replaying_)
+			drop_locked();
+	}
+
+	/** @brief Call f(seq, record) for every record found on disk from the checkpoint on, once */
+	template<typename F>
+	void replay(F&& f) {
+		// no append before the end of the replay, and no segment is dropped: the list is stable
+		for (auto& s : segments_) {
+			auto seq = s.first;
+			for (size_t at = 0; at < s.write; ++seq) {
+				auto r = record_at(s, at);
+				if (seq >= replay_from_)
+					f(seq, r);
+				at += header_size + r.size();
+			}
+		}
+		std::unique_lock lock(mutex_);
+		replaying_ = false;
+		drop_locked();
+	}
+
+	/** @brief Number of the oldest record not processed */
+	uint64_t checkpoint() const {
+		std::unique_lock lock(mutex_);
+		return checkpoint_;
+	}
+
+private:
+	struct header {
+		uint32_t length;
+		uint32_t checksum;
+		uint64_t seq;
+	};
+
+	static constexpr size_t header_size = sizeof(header);
+
+	struct segment {
+		uint64_t first = 0; // number of its first record, in the file name
+		uint64_t end = 0;   // number after its last record
+		int fd = -1;
+		std::byte* data = nullptr;
+		size_t mapped = 0;   // length of the mapping
+		size_t capacity = 0; // end of the room for records, below mapped once sealed
+		size_t write = 0;    // end of the last record
+		std::filesystem::path path;
+	};
+
+	// FNV-1a, enough to tell a torn record from a complete one
+	static uint32_t checksum(std::span<const std::byte> bytes) {
+		uint32_t h = 2166136261u;
+		for (auto b : bytes)
+			h = (h ^ static_cast<uint32_t>(b)) * 16777619u;
+		return h;
+	}
+
+	static std::span<const std::byte> record_at(const segment& s, size_t at) {
+		header h;
+		std::memcpy(&h, s.data + at, header_size);
+		return {s.data + at + header_size, h.length};
+	}
+
+	// the record at offset at if it is complete and numbered seq
+	static std::optional<std::span<const std::byte>> valid_record(const segment& s, size_t at, uint64_t seq) {
+		if (s.capacity - at < header_size)
+			return std::nullopt;
+		header h;
+		std::memcpy(&h, s.data + at, header_size);
+		if (h.seq != seq || s.capacity - at - header_size < h.length)
+			return std::nullopt;
+		auto r = record_at(s, at);
+		if (checksum(r) != h.checksum)
+			return std::nullopt;
+		return r;
+	}
+
+	static std::string segment_name(uint64_t first) {
+		auto n = std::to_string(first);
+		return "wal-" + std::string(20 - n.size(), '0') + n + ".log"; // sorts by number
+	}
+
+	static std::optional<uint64_t> segment_number(const std::filesystem::path& p) {
+		auto name = p.filename().string();
+		if (name.size() != 28 || !name.starts_with("wal-") || !name.ends_with(".log"))
+			return std::nullopt;
+		// anything but 20 digits is not a segment of ours and is left alone
+		auto digits = std::string_view(name).substr(4, 20);
+		uint64_t n = 0;
+		auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), n);
+		if (ec != std::errc{} || end != digits.data() + digits.size())
+			return std::nullopt;
+		return n;
+	}
+
+	void open_checkpoint() {
+		auto path = dir_ / "checkpoint";
+		checkpoint_fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (checkpoint_fd_ < 0)
+			throw std::system_error(errno, std::generic_category(), "ctq: write-ahead log checkpoint");
+		int err = ::posix_fallocate(checkpoint_fd_, 0, sizeof(uint64_t)); // zero in a new file
+		if (err == 0) {
+			checkpoint_map_ = ::mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint_fd_, 0);
+			if (checkpoint_map_ == MAP_FAILED)
+				err = errno;
+		}
+		if (err != 0) {
+			::close(checkpoint_fd_);
+			throw std::system_error(err, std::generic_category(), "ctq: write-ahead log checkpoint");
+		}
+		std::memcpy(&checkpoint_, checkpoint_map_, sizeof(checkpoint_));
+	}
+
+	void close_checkpoint() {
+		::munmap(checkpoint_map_, sizeof(uint64_t));
+		::close(checkpoint_fd_);
+	}
+
+	segment map_new(uint64_t first, size_t capacity) const {
+		segment s;
+		s.first = s.end = first;
+		s.path = dir_ / segment_name(first);
+		s.fd = ::open(s.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644); // never over an existing segment
+		if (s.fd < 0)
+			throw std::system_error(errno, std::generic_category(), "ctq: write-ahead log segment");
+		if (int err = ::posix_fallocate(s.fd, 0, static_cast<off_t>(capacity)); err != 0) {
+			::close(s.fd);
+			throw std::system_error(err, std::generic_category(), "ctq: write-ahead log segment");
+		}
+		map(s, capacity);
+		sync_directory(); // the new file must be found after a crash, not only its data
+		return s;
+	}
+
+	segment map_existing(const std::filesystem::path& path, uint64_t first) const {
+		segment s;
+		s.first = s.end = first;
+		s.path = path;
+		s.fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (s.fd < 0)
+			throw std::system_error(errno, std::generic_category(), "ctq: write-ahead log segment");
+		struct stat st;
+		if (::fstat(s.fd, &st) != 0) {
+			int err = errno;
+			::close(s.fd);
+			throw std::system_error(err, std::generic_category(), "ctq: write-ahead log segment");
+		}
+		map(s, static_cast<size_t>(st.st_size));
+		return s;
+	}
+
+	void sync_directory() const {
+		int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0) {
+			::fsync(fd);
+			::close(fd);
+		}
+	}
+
+	static void map(segment& s, size_t capacity) {
+		s.mapped = s.capacity = capacity;
+		if (capacity == 0)
+			return;
+		void* p = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, s.fd, 0);
+		if (p == MAP_FAILED) {
+			int err = errno;
+			::close(s.fd);
+			throw std::system_error(err, std::generic_category(), "ctq: write-ahead log segment");
+		}
+		s.data = static_cast<std::byte*>(p);
+	}
+
+	static void unmap(segment& s) {
+		if (s.data)
+			::munmap(s.data, s.mapped);
+		::close(s.fd);
+	}
+
+	// locked: delete the segments whose records are all processed, never the one appended to
+	void drop_locked() {
+		if (segments_.size() < 2 || segments_.front().end > checkpoint_)
+			return;
+		// after a crash the checkpoint on disk must not be behind the records deleted
+		if (::fdatasync(checkpoint_fd_) != 0)
+			return; // kept until a later checkpoint is flushed
+		while (segments_.size() > 1 && segments_.front().end <= checkpoint_) {
+			auto& s = segments_.front();
+			unmap(s);
+			std::error_code ec;
+			std::filesystem::remove(s.path, ec); // replayed again if left behind, which is harmless
+			segments_.pop_front();
+		}
+	}
+
+	std::filesystem::path dir_;
+	size_t segment_size_;
+	mutable std::mutex mutex_;
+	std::condition_variable synced_cv_;
+	std::deque<segment> segments_; // oldest first, records are appended to the last one
+	uint64_t next_{};   // number of the next record
+	uint64_t synced_{}; // records numbered below are on disk
+	bool syncing_ = false; // a sync() round is flushing, without the lock
+	uint64_t checkpoint_{};
+	uint64_t replay_from_{}; // the checkpoint found on disk
+	std::unordered_set<uint64_t> acked_; // acknowledged after the checkpoint, out of order
+	bool replaying_ = true;
+	int checkpoint_fd_ = -1;
+	void* checkpoint_map_ = nullptr;
+};
+
+	// an item with the number of its log record
+template<typename T>
+struct logged {
+	uint64_t seq{};
+	T item{};
+};
+
+} // namespace detail
+
+/** @brief Task queue whose items survive a crash: at-least-once processing across restarts
+ *
+ * Every pushed item is serialized with the codec and appended to a write-ahead log in dir
+ * before it is queued, and push() returns once the log record is on disk. Concurrent pushes
+ * share one fdatasync (group commit) and push_batch() needs one for the whole batch, so
+ * durability does not cost a system call per item. When the callback returns, the worker
+ * acknowledges the item and the log checkpoint moves past it.
+ *
+ * The constructor replays the items logged and not acknowledged by a previous instance on
+ * the same directory, whether it crashed or was destroyed with items still queued, before any
+ * new push. An item may therefore be processed twice (its callback ran, the process died before
+ * the acknowledgement reached the disk), never lost: callbacks should be idempotent.
+ *
+ * Example:
+ *   ctq::durable_queue<order> queue(execute, "/var/lib/orders", codec, 10'000, 4);
+ *   queue.push(o); // on disk when this returns
+ *
+ * As for basic_task_queue, an exception escaping the callback terminates the process.
+ * Linux only.
+ *
+ * @tparam T The item type, serialized with a spill_codec<T>.
+ * @tparam Container The container of the queue in memory, as for task_queue.
+ */
+template<typename T, template<typename... U> class Container = std::deque>
+struct durable_queue {
+	using type = T;
+	using callback = std::function<void(T)>;
+
+	/**
+	 * @param cb The callback, called by the workers for every item.
+	 * @param dir Directory of the write-ahead log, one queue per directory.
+	 * @param codec Converts items to log records and back.
+	 * @param max_elements Bound of the queue in memory, the log is unbounded.
+	 * @param workers Number of worker threads.
+	 * @param segment_size Size of a log segment file.
+	 * @throws std::system_error if the log cannot be opened.
+	 */
+	durable_queue(callback cb, std::filesystem::path dir, spill_codec<T> codec, std::optional<size_t> max_elements = std::nullopt,
+		size_t workers = 1, size_t segment_size = 64 << 20)
+		: codec_(std::move(codec))
+		  ,log_(std::move(dir), segment_size)
+		  ,queue_(std::make_unique<queue_type>(
+			[this, cb = std::move(cb)](entry e) {
+				cb(std::move(e.item));
+				log_.ack(e.seq);
+			},
+			max_elements, workers))
+	{
+		log_.replay([this](uint64_t seq, std::span<const std::byte> record) {
+			queue_->push(entry{seq, codec_.decode(record)});
+			++replayed_;
+		});
+	}
+
+	durable_queue(const durable_queue&) = delete;
+	durable_queue& operator=(const durable_queue&) = delete;
+
+	/** @brief Log an item and queue it, returns once the log record is on disk
+	 *
+	 * Blocks while a bounded queue is full, after the item is logged.
+	 * @throws std::system_error if the log cannot be written.
+	 */
+	void push(T item) {
+		std::vector<std::byte> bytes;
+		codec_.encode(item, bytes);
+		auto seq = log_.append(bytes);
+		log_.sync(seq + 1);
+		queue_->push(entry{seq, std::move(item)});
+	}
+
+	/** @brief Same as push but constructs the item from args */
+	template<typename... Args>
+	void emplace(Args&&... args) {
+		push(T(std::forward<Args>(args)...));
+	}
+
+	/** @brief Log the items of a range, moved from, with a single sync, then queue them */
+	template<typename It>
+	void push_batch(It first, It last) {
+		std::vector<entry> entries;
+		std::vector<std::byte> bytes;
+		for (; first != last; ++first) {
+			bytes.clear();
+			codec_.encode(*first, bytes);
+			entries.push_back(entry{log_.append(bytes), std::move(*first)});
+		}
+		if (entries.empty())
+			return;
+		log_.sync(entries.back().seq + 1);
+		queue_->push_batch(entries.begin(), entries.end());
+	}
+
+	/** @brief Number of queued items, without taking the lock */
+	size_t size() const {
+		return queue_->size();
+	}
+
+	/** @brief Number of the oldest logged item not yet processed, items are numbered from 0 in push order */
+	uint64_t checkpoint() const {
+		return log_.checkpoint();
+	}
+
+	/** @brief Number of items replayed from the log by the constructor */
+	size_t replayed() const {
+		return replayed_;
+	}
+
+private:
+	using entry = detail::logged<T>;
+	using queue_type = basic_task_queue<Container<entry>>;
+
+	spill_codec<T> codec_;
+	detail::write_ahead_log log_;
+	size_t replayed_{};
+	std::unique_ptr<queue_type> queue_; // destroyed first: no acknowledgement after the log is closed
+};
+
+} // namespace ctq
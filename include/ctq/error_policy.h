@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace ctq {
+
+/** @brief A callback failure, as passed to the error handler or kept in the error queue
+ *
+ * @tparam T The item type of the queue.
+ */
+template<typename T>
+struct task_error {
+	std::exception_ptr error;
+	std::optional<T> item; // the failed item, only kept when retries or the error queue are enabled
+	size_t attempts{};
+};
+
+/** @brief What a basic_task_queue worker does when the callback throws
+ *
+ * The default policy catches nothing: as for any exception escaping a std::jthread,
+ * std::terminate is called. Otherwise the callback is run in a try block, which costs
+ * nothing until an exception is actually thrown. The options can be combined:
+ * - retry(n, backoff) runs the callback up to n more times, waiting backoff, 2 * backoff, ... in between
+ * - handler(f) calls f from the worker thread once the retries are exhausted
+ * - queue(n) keeps the last n failures for basic_task_queue::pop_error()
+ *
+ * Example: ctq::error_policy<int>{}.retry(3, std::chrono::milliseconds(10)).queue(100)
+ *
+ * The callback takes the item by value, so an item still needed after a failure is copied
+ * before the call: for every attempt followed by a retry, and for the last one when the error
+ * queue or, together with retries, the handler keeps it. That is one copy per item even when
+ * nothing throws, prefer items which are cheap to copy (e.g. a std::shared_ptr to a large
+ * payload) with these options; they require a copy constructible item type. Otherwise the
+ * item is moved into the callback, e.g. with a handler alone, which gets no item.
+ *
+ * @tparam T The item type of the queue.
+ */
+template<typename T>
+struct error_policy {
+	using handler_type = std::function<void(task_error<T>&)>;
+
+	handler_type on_error;
+	size_t retries{};
+	std::chrono::nanoseconds backoff{};
+	size_t queue_size{};
+
+	error_policy handler(handler_type f) const {
+		auto p = *this;
+		p.on_error = std::move(f);
+		return p;
+	}
+
+	error_policy retry(size_t n, std::chrono::nanoseconds first_backoff = {}) const {
+		auto p = *this;
+		p.retries = n;
+		p.backoff = first_backoff;
+		return p;
+	}
+
+	error_policy queue(size_t n) const {
+		auto p = *this;
+		p.queue_size = n;
+		return p;
+	}
+
+	// true if exceptions are caught at all
+	bool catches() const {
+		return on_error || retries > 0 || queue_size > 0;
+	}
+
+	// true if the item has to survive a failed callback
+	bool keeps_item() const {
+		return retries > 0 || queue_size > 0;
+	}
+
+	// wait before the given retry (1 based), doubling the backoff every time
+	std::chrono::nanoseconds backoff_before(size_t retry) const {
+		return backoff * (size_t{1} << std::min<size_t>(retry - 1, 20));
+	}
+};
+
+} // namespace ctq
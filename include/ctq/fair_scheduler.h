@@ -0,0 +1,186 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace ctq {
+
+struct fair_scheduler;
+
+namespace detail {
+
+	/** @brief A queue attached to a fair_scheduler
+	 *
+	 * The scheduler only sees this interface: run_one() takes one item and processes it,
+	 * the queue calls notify() whenever it adds an item. The bookkeeping members belong to
+	 * the scheduler and are guarded by its mutex.
+	 */
+struct fair_source {
+	fair_source() = default;
+	fair_source(const fair_source&) = delete;
+	fair_source& operator=(const fair_source&) = delete;
+
+	// process one item, false if there was none
+	virtual bool run_one(std::stop_token st) = 0;
+
+	inline void notify();
+
+protected:
+	~fair_source() = default;
+
+	// to be called by the destructor of the derived queue
+	inline void detach();
+
+private:
+	friend fair_scheduler;
+
+	fair_scheduler* sched_ = nullptr;
+	size_t weight_ = 1;
+	size_t deficit_ = 0;
+	uint64_t epoch_ = 0;  // bumped by every notify(), tells a stale "empty" from a real one
+	size_t running_ = 0;  // workers inside run_one()
+	bool active_ = false; // in the round robin
+	bool detached_ = false;
+};
+
+} // namespace detail
+
+/** @brief Worker pool shared by several queues, served by deficit round robin
+ *
+ * Instead of every basic_task_queue owning its threads, queues constructed with a
+ * fair_scheduler have none and are processed by the scheduler's workers. Queues with
+ * pending items take turns: each turn a queue may run up to weight items, so over time
+ * every busy queue gets a share of the workers proportional to its weight, and an idle
+ * queue costs nothing. A queue flooded with items cannot starve the others.
+ *
+ * Example:
+ *   ctq::fair_scheduler pool(std::thread::hardware_concurrency());
+ *   ctq::basic_task_queue<std::deque<job>> gold(on_job, std::nullopt, pool, 4);
+ *   ctq::basic_task_queue<std::deque<job>> bronze(on_job, std::nullopt, pool, 1);
+ *
+ * The scheduler must outlive the queues attached to it; a queue detaches itself when it
+ * is destroyed, waiting for the items of that queue still running.
+ */
+struct fair_scheduler {
+	explicit fair_scheduler(size_t workers) {
+		for (size_t i = 0; i < workers; ++i) {
+			workers_.emplace_back([this](std::stop_token st) { work(st); });
+		}
+	}
+
+	fair_scheduler(const fair_scheduler&) = delete;
+	fair_scheduler& operator=(const fair_scheduler&) = delete;
+
+	~fair_scheduler() {
+		for (auto& w : workers_)
+			w.request_stop();
+		workers_.clear(); // join before the members go away
+	}
+
+	size_t workers() const {
+		return workers_.size();
+	}
+
+	/** @brief Register a queue, called by its constructor */
+	void attach(detail::fair_source& s, size_t weight) {
+		std::unique_lock lock(mutex_);
+		s.sched_ = this;
+		s.weight_ = weight > 0 ? weight : 1;
+	}
+
+	/** @brief Unregister a queue, waits until no worker runs one of its items */
+	void detach(detail::fair_source& s) {
+		std::unique_lock lock(mutex_);
+		s.detached_ = true;
+		deactivate_locked(s);
+		idle_.wait(lock, [&s]() { return s.running_ == 0; });
+	}
+
+	/** @brief The queue has a new item */
+	void notify(detail::fair_source& s) {
+		{
+			std::unique_lock lock(mutex_);
+			if (s.detached_)
+				return;
+			++s.epoch_;
+			if (!s.active_) {
+				s.active_ = true;
+				s.deficit_ = s.weight_;
+				active_.push_back(&s);
+			}
+		}
+		cv_.notify_one();
+	}
+
+private:
+	void work(std::stop_token st) {
+		while (true) {
+			detail::fair_source* s;
+			uint64_t epoch;
+			{
+				std::unique_lock lock(mutex_);
+				if (!cv_.wait(lock, st, [this]() { return !active_.empty(); })) {
+					return; // stop requested
+				}
+				s = pick_locked();
+				epoch = s->epoch_;
+				++s->running_;
+			}
+			bool ran = s->run_one(st);
+			std::unique_lock lock(mutex_);
+			--s->running_;
+			// nothing was pushed since the pick and there was nothing to take: the queue is empty
+			if (!ran && s->epoch_ == epoch)
+				deactivate_locked(*s);
+			if (s->detached_ && s->running_ == 0)
+				idle_.notify_all();
+		}
+	}
+
+	// deficit round robin: the front queue runs while it has deficit left, then goes to the
+	// back with a fresh quantum of weight items
+	detail::fair_source* pick_locked() {
+		while (true) {
+			auto s = active_.front();
+			if (s->deficit_ > 0) {
+				--s->deficit_;
+				return s;
+			}
+			s->deficit_ = s->weight_;
+			active_.pop_front();
+			active_.push_back(s);
+		}
+	}
+
+	void deactivate_locked(detail::fair_source& s) {
+		if (!s.active_)
+			return;
+		s.active_ = false;
+		s.deficit_ = 0;
+		std::erase(active_, &s);
+	}
+
+	std::mutex mutex_;
+	std::condition_variable_any cv_;
+	std::condition_variable idle_;
+	std::deque<detail::fair_source*> active_; // queues with (possibly) pending items
+	std::vector<std::jthread> workers_;
+};
+
+void detail::fair_source::notify() {
+	if (sched_)
+		sched_->notify(*this);
+}
+
+void detail::fair_source::detach() {
+	if (sched_)
+		sched_->detach(*this);
+}
+
+} // namespace ctq
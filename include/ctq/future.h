@@ -0,0 +1,372 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ctq {
+
+template<typename R>
+struct future;
+
+namespace detail {
+
+template<typename R>
+struct future_state;
+
+template<typename R>
+struct when_all_state;
+
+	/** @brief Per-thread cache of released future states
+	 *
+	 * States are recycled through a small thread local free list instead of going back to
+	 * the allocator. The thread reading the result (usually the submitting one) is normally
+	 * the last owner, so a producer reuses the states of its own previous submissions.
+	 */
+template<typename R>
+struct state_pool {
+	static constexpr size_t max_cached = 256;
+
+	static future_state<R>* acquire() {
+		auto& c = cache();
+		void* p;
+		if (c.free.empty()) {
+			p = ::operator new(sizeof(future_state<R>));
+		} else {
+			p = c.free.back();
+			c.free.pop_back();
+		}
+		return new (p) future_state<R>();
+	}
+
+	static void release(future_state<R>* s) {
+		s->~future_state<R>();
+		auto& c = cache();
+		if (c.free.size() < max_cached) {
+			c.free.push_back(s);
+		} else {
+			::operator delete(s);
+		}
+	}
+
+private:
+	struct cache_type {
+		std::vector<void*> free;
+
+		~cache_type() {
+			for (auto p : free)
+				::operator delete(p);
+		}
+	};
+
+	static cache_type& cache() {
+		thread_local cache_type c;
+		return c;
+	}
+};
+
+	/** @brief Shared state of a promise/future pair
+	 *
+	 * Reference counted by the two sides, completion is published through an atomic flag
+	 * word, waiting uses std::atomic::wait. There is no mutex: the value is written once
+	 * before the ready bit is set and read only after it was observed.
+	 */
+template<typename R>
+struct future_state {
+	static constexpr uint32_t ready_bit = 1;
+	static constexpr uint32_t hook_bit = 2;
+	using value_type = std::conditional_t<std::is_void_v<R>, std::monostate, R>;
+
+	template<typename... Args>
+	void set_value(Args&&... args) {
+		value_.emplace(std::forward<Args>(args)...);
+		publish();
+	}
+
+	void set_exception(std::exception_ptr e) {
+		error_ = std::move(e);
+		publish();
+	}
+
+	bool ready() const {
+		return flags_.load(std::memory_order_acquire) & ready_bit;
+	}
+
+	void wait() const {
+		auto f = flags_.load(std::memory_order_acquire);
+		while (!(f & ready_bit)) {
+			flags_.wait(f, std::memory_order_acquire);
+			f = flags_.load(std::memory_order_acquire);
+		}
+	}
+
+	// call f(ctx) once the state is ready, immediately if it already is; at most one hook
+	void then(void (*f)(void*), void* ctx) {
+		hook_ = f;
+		hook_ctx_ = ctx;
+		if (flags_.fetch_or(hook_bit, std::memory_order_acq_rel) & ready_bit)
+			f(ctx);
+	}
+
+	// valid once ready
+	value_type take() {
+		if (error_)
+			std::rethrow_exception(error_);
+		return std::move(*value_);
+	}
+
+	void release() {
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			state_pool<R>::release(this);
+	}
+
+private:
+	void publish() {
+		auto old = flags_.fetch_or(ready_bit, std::memory_order_acq_rel);
+		flags_.notify_all();
+		if (old & hook_bit)
+			hook_(hook_ctx_);
+	}
+
+	std::atomic<uint32_t> flags_{};
+	std::atomic<uint32_t> refs_{2}; // promise and future
+	std::optional<value_type> value_;
+	std::exception_ptr error_;
+	void (*hook_)(void*) = nullptr;
+	void* hook_ctx_ = nullptr;
+};
+
+	/** @brief Producing side of a future
+	 *
+	 * Destroying a promise which was never satisfied makes the future throw
+	 * std::future_error(broken_promise), e.g. when a queue is destroyed with pending items.
+	 */
+template<typename R>
+struct promise {
+	promise() = default;
+
+	explicit promise(future_state<R>* s) : s_(s) {}
+
+	promise(promise&& o) noexcept : s_(std::exchange(o.s_, nullptr)) {}
+
+	promise& operator=(promise&& o) noexcept {
+		if (this != &o) {
+			reset();
+			s_ = std::exchange(o.s_, nullptr);
+		}
+		return *this;
+	}
+
+	~promise() {
+		reset();
+	}
+
+	// false for fire-and-forget items, pushed without a future
+	explicit operator bool() const {
+		return s_ != nullptr;
+	}
+
+	template<typename... Args>
+	void set_value(Args&&... args) {
+		s_->set_value(std::forward<Args>(args)...);
+		std::exchange(s_, nullptr)->release();
+	}
+
+	void set_exception(std::exception_ptr e) {
+		s_->set_exception(std::move(e));
+		std::exchange(s_, nullptr)->release();
+	}
+
+	/** @brief Run f(args...) and store its result or exception */
+	template<typename F, typename... Args>
+	void run(F& f, Args&&... args) {
+		try {
+			if constexpr (std::is_void_v<R>) {
+				f(std::forward<Args>(args)...);
+				set_value();
+			} else {
+				set_value(f(std::forward<Args>(args)...));
+			}
+		} catch (...) {
+			set_exception(std::current_exception());
+		}
+	}
+
+private:
+	void reset() {
+		if (s_)
+			set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+	}
+
+	future_state<R>* s_ = nullptr;
+};
+
+template<typename R>
+std::pair<promise<R>, future<R>> make_promise();
+
+} // namespace detail
+
+/** @brief Single-shot future returned by task_queue::submit()
+ *
+ * A lighter std::future: the shared state comes from a per-thread pool, completion is an
+ * atomic flag and waiting uses std::atomic::wait, no mutex or condition variable is involved.
+ * get() can be called once.
+ *
+ * @tparam R The result type, may be void.
+ */
+template<typename R>
+struct future {
+	using value_type = R;
+
+	future() = default;
+
+	future(future&& o) noexcept : s_(std::exchange(o.s_, nullptr)) {}
+
+	future& operator=(future&& o) noexcept {
+		if (this != &o) {
+			if (s_)
+				s_->release();
+			s_ = std::exchange(o.s_, nullptr);
+		}
+		return *this;
+	}
+
+	~future() {
+		if (s_)
+			s_->release();
+	}
+
+	bool valid() const {
+		return s_ != nullptr;
+	}
+
+	bool ready() const {
+		return s_->ready();
+	}
+
+	void wait() const {
+		s_->wait();
+	}
+
+	/** @brief Wait for the result and return it, rethrows the exception of a failed task */
+	R get() {
+		s_->wait();
+		auto s = std::exchange(s_, nullptr);
+		struct releaser {
+			detail::future_state<R>* s;
+			~releaser() { s->release(); }
+		} r{s};
+		if constexpr (std::is_void_v<R>) {
+			s->take();
+		} else {
+			return s->take();
+		}
+	}
+
+private:
+	template<typename U>
+	friend std::pair<detail::promise<U>, future<U>> detail::make_promise();
+
+	template<typename U>
+	friend struct detail::when_all_state;
+
+	explicit future(detail::future_state<R>* s) : s_(s) {}
+
+	detail::future_state<R>* s_ = nullptr;
+};
+
+namespace detail {
+
+template<typename R>
+std::pair<promise<R>, future<R>> make_promise() {
+	auto s = state_pool<R>::acquire();
+	return {promise<R>(s), future<R>(s)};
+}
+
+template<typename R>
+using when_all_result = std::conditional_t<std::is_void_v<R>, void, std::vector<R>>;
+
+// Shared state of when_all(), deletes itself when the last input is ready
+template<typename R>
+struct when_all_state {
+	std::vector<future<R>> inputs;
+	std::atomic<size_t> remaining;
+	detail::promise<detail::when_all_result<R>> out;
+
+	static void on_ready(void* ctx) {
+		auto self = static_cast<when_all_state*>(ctx);
+		if (self->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			self->finish();
+			delete self;
+		}
+	}
+
+	void finish() {
+		try {
+			if constexpr (std::is_void_v<R>) {
+				for (auto& f : inputs)
+					f.get();
+				out.set_value();
+			} else {
+				std::vector<R> results;
+				results.reserve(inputs.size());
+				for (auto& f : inputs)
+					results.push_back(f.get());
+				out.set_value(std::move(results));
+			}
+		} catch (...) {
+			out.set_exception(std::current_exception());
+		}
+	}
+
+	static void attach(when_all_state* self) {
+		// copy the size first: the last hook may delete self
+		auto n = self->inputs.size();
+		for (size_t i = 0; i < n; ++i)
+			self->inputs[i].s_->then(&on_ready, self);
+	}
+};
+
+} // namespace detail
+
+/** @brief Future which becomes ready when all the given futures are
+ *
+ * Does not block and uses no thread: the last input to complete builds the result.
+ * The result holds the values in input order (nothing for R = void); if a task failed,
+ * the exception of the first failed input in order is rethrown by get().
+ *
+ * @param futures The futures to wait for, they are consumed.
+ */
+template<typename R>
+future<detail::when_all_result<R>> when_all(std::vector<future<R>> futures) {
+	auto [p, f] = detail::make_promise<detail::when_all_result<R>>();
+	if (futures.empty()) {
+		if constexpr (std::is_void_v<R>) {
+			p.set_value();
+		} else {
+			p.set_value(std::vector<R>{});
+		}
+		return std::move(f);
+	}
+	auto state = new detail::when_all_state<R>{std::move(futures), {}, std::move(p)};
+	state->remaining.store(state->inputs.size(), std::memory_order_relaxed);
+	detail::when_all_state<R>::attach(state);
+	return std::move(f);
+}
+
+/** @brief when_all() over a range of futures, which are moved from */
+template<typename It>
+auto when_all(It first, It last) {
+	using R = typename std::iterator_traits<It>::value_type::value_type;
+	return when_all(std::vector<future<R>>(std::make_move_iterator(first), std::make_move_iterator(last)));
+}
+
+} // namespace ctq
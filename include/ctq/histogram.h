@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace ctq {
+
+struct histogram_recorder;
+
+/** @brief Log-linear (HDR style) histogram of non-negative integer values
+ *
+ * Values below 2^sub_bucket_bits are counted exactly. Larger values fall into one of
+ * 2^sub_bucket_bits linear sub-buckets per power of two, so a reported value is within
+ * about 3% of the recorded one. Values above max_value() are clamped into the last bucket.
+ * Used for latencies in nanoseconds, where max_value() is about 18 minutes.
+ */
+struct histogram {
+	static constexpr unsigned sub_bucket_bits = 5;
+	static constexpr uint64_t sub_bucket_count = uint64_t{1} << sub_bucket_bits;
+	static constexpr unsigned max_value_bits = 40;
+	static constexpr size_t bucket_count = (max_value_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+	static constexpr uint64_t max_value() {
+		return (uint64_t{1} << max_value_bits) - 1;
+	}
+
+	static constexpr size_t bucket_index(uint64_t v) {
+		v = std::min(v, max_value());
+		if (v < sub_bucket_count)
+			return v;
+		// v >> e keeps the top sub_bucket_bits + 1 bits, i.e. lands in [sub_bucket_count, 2 * sub_bucket_count)
+		unsigned e = std::bit_width(v) - sub_bucket_bits - 1;
+		return e * sub_bucket_count + (v >> e);
+	}
+
+	// highest value that maps to bucket i
+	static constexpr uint64_t bucket_upper(size_t i) {
+		if (i < sub_bucket_count)
+			return i;
+		uint64_t e = i / sub_bucket_count - 1;
+		uint64_t m = i % sub_bucket_count + sub_bucket_count;
+		return ((m + 1) << e) - 1;
+	}
+
+	void record(uint64_t v, uint64_t n = 1) {
+		counts_[bucket_index(v)] += n;
+		total_ += n;
+		sum_ += v * n;
+		max_ = std::max(max_, v);
+	}
+
+	void merge(const histogram& other) {
+		for (size_t i = 0; i < bucket_count; ++i)
+			counts_[i] += other.counts_[i];
+		total_ += other.total_;
+		sum_ += other.sum_;
+		max_ = std::max(max_, other.max_);
+	}
+
+	uint64_t count() const {
+		return total_;
+	}
+
+	uint64_t max() const {
+		return max_;
+	}
+
+	double mean() const {
+		return total_ ? static_cast<double>(sum_) / static_cast<double>(total_) : 0.0;
+	}
+
+	/** @brief Value at or below which p percent of the recorded values fall
+	 *
+	 * @param p Percentile in the range [0, 100], e.g. 99.9 for p999.
+	 * @return The upper bound of the bucket holding the requested rank, 0 if empty.
+	 */
+	uint64_t percentile(double p) const {
+		if (total_ == 0)
+			return 0;
+		auto rank = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * static_cast<double>(total_)));
+		rank = std::max<uint64_t>(rank, 1);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; ++i) {
+			seen += counts_[i];
+			if (seen >= rank)
+				return std::min(bucket_upper(i), max_);
+		}
+		return max_;
+	}
+
+	uint64_t bucket(size_t i) const {
+		return counts_[i];
+	}
+
+private:
+	friend struct histogram_recorder;
+
+	std::array<uint64_t, bucket_count> counts_{};
+	uint64_t total_{};
+	uint64_t sum_{};
+	uint64_t max_{};
+};
+
+/** @brief Lock-free recorder feeding a histogram
+ *
+ * Intended to be written by one thread (e.g. a worker) and read concurrently by any
+ * number of threads through snapshot(). All accesses are relaxed: a snapshot is a
+ * consistent-enough view for monitoring, not a linearizable one.
+ */
+struct histogram_recorder {
+	void record(uint64_t v) {
+		counts_[histogram::bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(v, std::memory_order_relaxed);
+		auto m = max_.load(std::memory_order_relaxed);
+		while (v > m && !max_.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+		}
+	}
+
+	/** @brief Add the recorded values to h */
+	void merge_into(histogram& h) const {
+		for (size_t i = 0; i < histogram::bucket_count; ++i) {
+			auto n = counts_[i].load(std::memory_order_relaxed);
+			h.counts_[i] += n;
+			h.total_ += n;
+		}
+		h.sum_ += sum_.load(std::memory_order_relaxed);
+		h.max_ = std::max(h.max_, max_.load(std::memory_order_relaxed));
+	}
+
+	histogram snapshot() const {
+		histogram h;
+		merge_into(h);
+		return h;
+	}
+
+private:
+	std::array<std::atomic<uint64_t>, histogram::bucket_count> counts_{};
+	std::atomic<uint64_t> sum_{};
+	std::atomic<uint64_t> max_{};
+};
+
+} // namespace ctq
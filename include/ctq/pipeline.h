@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <ctq/task_queue.h>
+
+namespace ctq {
+
+/** @brief One stage of a pipeline: the callback and how it runs
+ *
+ * The callback takes the output of the previous stage (or the pipeline input) and returns
+ * the input of the next one; the result of the last stage is discarded.
+ *
+ * @tparam Sig The signature of the callback, R(T), deduced from the callable.
+ */
+template<typename Sig>
+struct stage;
+
+template<typename R, typename T>
+struct stage<R(T)> {
+	using input_type = std::decay_t<T>;
+	using result_type = R;
+
+	/**
+	 * @param fn The callback.
+	 * @param workers Worker threads of the stage.
+	 * @param max_elements Bound of the buffer in front of the stage, a full buffer blocks the stage before.
+	 */
+	template<typename F>
+	stage(F fn, size_t workers = 1, std::optional<size_t> max_elements = 64)
+		: fn(std::move(fn))
+		  ,workers(workers)
+		  ,max_elements(max_elements)
+	{ }
+
+	std::function<R(T)> fn;
+	size_t workers;
+	std::optional<size_t> max_elements;
+};
+
+namespace detail {
+
+	// R(T) of a callable, as deduced by std::function
+template<typename F>
+struct signature_of;
+
+template<typename R, typename T>
+struct signature_of<std::function<R(T)>> {
+	using type = R(T);
+};
+
+template<typename F>
+using signature_t = typename signature_of<decltype(std::function{std::declval<F>()})>::type;
+
+} // namespace detail
+
+template<typename F>
+stage(F, size_t = 1, std::optional<size_t> = 64) -> stage<detail::signature_t<F>>;
+
+/** @brief Stages chained through bounded task queues
+ *
+ * Every stage gets a basic_task_queue holding its input, with the stage's workers and bound;
+ * a stage's result is pushed into the queue of the next stage. When a stage falls behind, its
+ * buffer fills up, the workers of the stage before block in push() and the backpressure
+ * travels up to the producers of the pipeline.
+ *
+ * Example:
+ *   ctq::pipeline p(
+ *       ctq::stage([](std::string raw) { return parse(raw); }, 2),
+ *       ctq::stage([](order o) { return enrich(std::move(o)); }, 4, 256),
+ *       ctq::stage([](order o) { persist(o); }));
+ *   p.push(line);
+ *   p.drain();
+ *
+ * The stages are stopped from the first to the last, so a worker blocked on a full
+ * downstream buffer always completes its push; items still queued are discarded, call
+ * drain() first to process them. With more than one worker a stage may reorder items. As for
+ * basic_task_queue, an exception escaping a stage callback terminates the process.
+ *
+ * @tparam Sigs The signatures of the stage callbacks, R(T), deduced from the stages.
+ */
+template<typename... Sigs>
+struct pipeline {
+	static_assert(sizeof...(Sigs) > 0, "ctq: a pipeline needs at least one stage");
+
+	static constexpr size_t stage_count = sizeof...(Sigs);
+
+	using stages_type = std::tuple<stage<Sigs>...>;
+
+	template<size_t I>
+	using input_type = typename std::tuple_element_t<I, stages_type>::input_type;
+
+	using type = input_type<0>;
+
+	explicit pipeline(stage<Sigs>... stages) {
+		build(std::index_sequence_for<Sigs...>{}, stages...);
+	}
+
+	pipeline(const pipeline&) = delete;
+	pipeline& operator=(const pipeline&) = delete;
+
+	~pipeline() {
+		stop(std::index_sequence_for<Sigs...>{});
+	}
+
+	/** @brief Add an item to the first stage, blocks while its buffer is full */
+	void push(type item) {
+		in_flight_.fetch_add(1, std::memory_order_relaxed);
+		std::get<0>(queues_)->push(std::move(item));
+	}
+
+	/** @brief Same as push but constructs the item from args */
+	template<typename... Args>
+	void emplace(Args&&... args) {
+		push(type(std::forward<Args>(args)...));
+	}
+
+	/** @brief Wait until every item pushed so far went through the last stage */
+	void drain() const {
+		auto n = in_flight_.load(std::memory_order_acquire);
+		while (n != 0) {
+			in_flight_.wait(n, std::memory_order_acquire);
+			n = in_flight_.load(std::memory_order_acquire);
+		}
+	}
+
+	/** @brief Items pushed and not yet through the last stage */
+	uint64_t in_flight() const {
+		return in_flight_.load(std::memory_order_relaxed);
+	}
+
+private:
+	template<size_t I>
+	using queue_type = basic_task_queue<std::deque<input_type<I>>>;
+
+	template<size_t... Is>
+	static auto queues_for(std::index_sequence<Is...>) -> std::tuple<std::unique_ptr<queue_type<Is>>...>;
+
+	template<size_t... Is>
+	void build(std::index_sequence<Is...>, stage<Sigs>&... stages) {
+		auto all = std::forward_as_tuple(stages...);
+		// from the last stage to the first, a stage pushes into the queue after it
+		(make_queue<stage_count - 1 - Is>(std::get<stage_count - 1 - Is>(all)), ...);
+	}
+
+	template<size_t I, typename S>
+	void make_queue(S& s) {
+		typename queue_type<I>::callback cb;
+		if constexpr (I + 1 < stage_count) {
+			static_assert(std::is_convertible_v<typename S::result_type, input_type<I + 1>>,
+				"ctq: a stage must return the input type of the next stage");
+			cb = [fn = std::move(s.fn), next = std::get<I + 1>(queues_).get()](input_type<I> item) {
+				next->push(fn(std::move(item)));
+			};
+		} else {
+			cb = [this, fn = std::move(s.fn)](input_type<I> item) {
+				fn(std::move(item));
+				if (in_flight_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					in_flight_.notify_all();
+			};
+		}
+		std::get<I>(queues_) = std::make_unique<queue_type<I>>(std::move(cb), s.max_elements, s.workers);
+	}
+
+	template<size_t... Is>
+	void stop(std::index_sequence<Is...>) {
+		(std::get<Is>(queues_).reset(), ...);
+	}
+
+	mutable std::atomic<uint64_t> in_flight_{};
+	decltype(queues_for(std::index_sequence_for<Sigs...>{})) queues_; // one per stage, holding its input
+};
+
+} // namespace ctq
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ctq/cache_line.h>
+#include <ctq/circular_buffer.h>
+
+namespace ctq {
+
+/** @brief Multi-stage pipeline over one pre-allocated ring, Disruptor style
+ *
+ * Chaining stages (parse, enrich, persist) through separate task queues costs a lock and a
+ * move per hop. Here every item is written once into a slot of a circular_buffer and the
+ * stages process it there, in place, one after the other. Each stage runs on its own thread
+ * and publishes how far it got in an atomic cursor; a stage may process a slot once all the
+ * stages it depends on have passed it (its sequence barrier), and the producer may reuse a
+ * slot once every stage has passed it. Hand-offs are a release store and a std::atomic::wait,
+ * with no lock and no copy.
+ *
+ * Stages form a dependency graph: a stage added without dependencies sees the items as they
+ * are pushed, one added after others waits for all of them. Stages that do not depend on each
+ * other run concurrently on the same slot and must not modify the same parts of the item.
+ *
+ * Example:
+ *   ctq::sequenced_ring<order> ring(4096);
+ *   auto parse = ring.add_stage([](order& o) { o.parse(); });
+ *   auto risk = ring.add_stage([](order& o) { o.check_risk(); }, {parse});
+ *   auto book = ring.add_stage([](order& o) { o.book(); }, {parse});
+ *   ring.add_stage([](order& o) { journal(o); }, {risk, book});
+ *   ring.push(order(raw));
+ *
+ * The destructor lets every stage finish the items already pushed. As for basic_task_queue,
+ * an exception escaping a stage callback terminates the process.
+ *
+ * @tparam T The item type, default constructible and move assignable.
+ */
+template<typename T>
+struct sequenced_ring {
+	using type = T;
+	using callback = std::function<void(T&)>;
+
+	/** @param capacity The number of slots, i.e. how far the producers can run ahead of the last stage. */
+	explicit sequenced_ring(size_t capacity)
+		: ring_(capacity)
+	{ }
+
+	sequenced_ring(const sequenced_ring&) = delete;
+	sequenced_ring& operator=(const sequenced_ring&) = delete;
+
+	~sequenced_ring() {
+		close(published_);
+		// a stage stops once its barrier is closed and drained, then closes its own cursor
+		for (auto& s : stages_)
+			s.thread.join();
+	}
+
+	/** @brief Add a stage running cb on every item, on a thread of its own
+	 *
+	 * Stages are added before the first push.
+	 *
+	 * @param after Ids of the stages which process an item before this one, none to start
+	 *              with the pushed items.
+	 * @return The id of the stage, for later stages and processed().
+	 */
+	size_t add_stage(callback cb, std::initializer_list<size_t> after = {}) {
+		assert(next_ == 0);
+		auto id = stages_.size();
+		auto& s = stages_.emplace_back();
+		s.cb = std::move(cb);
+		for (auto dep : after) {
+			assert(dep < id);
+			stages_[dep].leaf = false;
+			s.barrier.push_back(&stages_[dep].cursor);
+		}
+		if (s.barrier.empty())
+			s.barrier.push_back(&published_);
+		s.thread = std::jthread([this, &s]() { work(s); });
+		return id;
+	}
+
+	/** @brief Publish an item to the first stages, blocks while the ring is full */
+	void push(T item) {
+		std::unique_lock lock(mutex_);
+		auto seq = next_++;
+		// the slot is free once every stage is past the item which used it last
+		if (seq >= ring_.capacity()) {
+			for (auto& s : stages_) {
+				if (s.leaf)
+					wait_until(s.cursor, seq - ring_.capacity() + 1);
+			}
+		}
+		ring_.slot(seq % ring_.capacity()) = std::move(item);
+		published_.store(seq + 1, std::memory_order_release);
+		published_.notify_all();
+	}
+
+	/** @brief Same as push but constructs the item from args */
+	template<typename... Args>
+	void emplace(Args&&... args) {
+		push(T(std::forward<Args>(args)...));
+	}
+
+	/** @brief Number of items pushed */
+	uint64_t published() const {
+		return value(published_.load(std::memory_order_acquire));
+	}
+
+	/** @brief Number of items the stage has processed */
+	uint64_t processed(size_t stage) const {
+		return value(stages_[stage].cursor.load(std::memory_order_acquire));
+	}
+
+	size_t stages() const {
+		return stages_.size();
+	}
+
+private:
+	// set in a cursor when nothing will be published through it anymore
+	static constexpr uint64_t closed_bit = uint64_t{1} << 63;
+
+	using cursor_type = std::atomic<uint64_t>;
+
+	struct stage {
+		alignas(detail::cache_line_size) cursor_type cursor{}; // items processed, written by the stage thread only
+		std::vector<const cursor_type*> barrier; // cursors of the stages before, or published_
+		callback cb;
+		bool leaf = true; // no stage depends on it
+		std::jthread thread;
+	};
+
+	static uint64_t value(uint64_t c) {
+		return c & ~closed_bit;
+	}
+
+	static void close(cursor_type& c) {
+		c.fetch_or(closed_bit, std::memory_order_release);
+		c.notify_all();
+	}
+
+	static void wait_until(const cursor_type& c, uint64_t seq) {
+		auto v = c.load(std::memory_order_acquire);
+		while (value(v) < seq && !(v & closed_bit)) {
+			c.wait(v, std::memory_order_acquire);
+			v = c.load(std::memory_order_acquire);
+		}
+	}
+
+	void work(stage& s) {
+		uint64_t next = 0;
+		while (true) {
+			// lowest cursor of the barrier: the stage may process the items before it
+			const cursor_type* lowest = nullptr;
+			uint64_t available = 0;
+			for (auto c : s.barrier) {
+				auto v = c->load(std::memory_order_acquire);
+				if (!lowest || value(v) < value(available)) {
+					lowest = c;
+					available = v;
+				}
+			}
+			if (value(available) > next) {
+				for (; next < value(available); ++next)
+					s.cb(ring_.slot(next % ring_.capacity()));
+				s.cursor.store(next, std::memory_order_release);
+				s.cursor.notify_all();
+				continue;
+			}
+			if (available & closed_bit) {
+				close(s.cursor);
+				return;
+			}
+			lowest->wait(available, std::memory_order_acquire);
+		}
+	}
+
+	circular_buffer<T> ring_; // used as plain slots, indexed by sequence number
+	std::mutex mutex_;        // serializes producers
+	uint64_t next_{};         // sequence number of the next push
+	alignas(detail::cache_line_size) cursor_type published_{};
+	std::deque<stage> stages_; // stable addresses, used by the stage threads
+};
+
+} // namespace ctq
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace ctq {
+
+/** @brief Serialization of the items a queue spills to disk, see basic_task_queue::set_spill()
+ *
+ * Both functions are called with the queue lock held, except decode in snapshot(), which
+ * may therefore run concurrently with another call. decode must accept every record
+ * encode produced and must not throw: it runs when a worker takes an item.
+ */
+template<typename T>
+struct spill_codec {
+	std::function<void(const T&, std::vector<std::byte>&)> encode; // append the bytes of an item
+	std::function<T(std::span<const std::byte>)> decode;
+};
+
+namespace detail {
+
+	/** @brief FIFO of byte records in append-only, memory-mapped segment files
+	 *
+	 * Records are written one after the other, each behind its length, into the newest
+	 * segment and read back from the oldest one. A segment which was read to its end is
+	 * unmapped, which frees its file; the last one is rewound instead once it is empty.
+	 * The files are created with O_TMPFILE and never have a name, so nothing is left on
+	 * disk when the process exits, however it exits. Their blocks are allocated up front:
+	 * a full disk is reported by push() rather than by a SIGBUS on a later write.
+	 * Not thread-safe, the queue calls it with its lock held. Linux only.
+	 */
+struct spill_file {
+	/**
+	 * @param dir Directory of the segment files, on a file system supporting O_TMPFILE.
+	 * @param segment_size Size of a segment file, a larger record gets a segment of its own.
+	 */
+	spill_file(std::filesystem::path dir, size_t segment_size)
+		: dir_(std::move(dir))
+		  ,segment_size_(segment_size)
+	{ }
+
+	spill_file(const spill_file&) = delete;
+	spill_file& operator=(const spill_file&) = delete;
+
+	~spill_file() {
+		for (auto& s : segments_)
+			unmap(s);
+	}
+
+	/** @throws std::system_error if a segment cannot be created, e.g. the disk is full. */
+	void push(std::span<const std::byte> record) {
+		uint64_t length = record.size();
+		auto need = sizeof(length) + record.size();
+		if (segments_.empty() || segments_.back().capacity - segments_.back().write < need)
+			segments_.push_back(map(std::max(segment_size_, need)));
+		auto& s = segments_.back();
+		std::memcpy(s.data + s.write, &length, sizeof(length));
+		std::memcpy(s.data + s.write + sizeof(length), record.data(), record.size());
+		s.write += need;
+		++count_;
+	}
+
+	/** @brief The oldest record, valid until the next pop() */
+	std::span<const std::byte> front() const {
+		auto& s = segments_.front();
+		return record_at(s, s.read);
+	}
+
+	void pop() {
+		auto& s = segments_.front();
+		s.read += sizeof(uint64_t) + front().size();
+		--count_;
+		if (s.read < s.write)
+			return;
+		if (segments_.size() > 1) {
+			unmap(s);
+			segments_.pop_front();
+		} else {
+			s.read = s.write = 0;
+		}
+	}
+
+	/** @brief Call f(std::span<const std::byte>) on every record, oldest first */
+	template<typename F>
+	void for_each(F&& f) const {
+		for (auto& s : segments_) {
+			for (size_t at = s.read; at < s.write; at += sizeof(uint64_t) + record_at(s, at).size())
+				f(record_at(s, at));
+		}
+	}
+
+	size_t size() const {
+		return count_;
+	}
+
+	bool empty() const {
+		return count_ == 0;
+	}
+
+private:
+	struct segment {
+		std::byte* data = nullptr;
+		size_t capacity = 0;
+		size_t write = 0; // end of the last record
+		size_t read = 0;  // start of the oldest record
+	};
+
+	static std::span<const std::byte> record_at(const segment& s, size_t at) {
+		uint64_t length;
+		std::memcpy(&length, s.data + at, sizeof(length));
+		return {s.data + at + sizeof(length), static_cast<size_t>(length)};
+	}
+
+#if defined(__linux__)
+	segment map(size_t capacity) const {
+		int fd = ::open(dir_.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "ctq: spill segment");
+		if (int err = ::posix_fallocate(fd, 0, static_cast<off_t>(capacity)); err != 0) {
+			::close(fd);
+			throw std::system_error(err, std::generic_category(), "ctq: spill segment");
+		}
+		void* p = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		int err = errno;
+		::close(fd); // the mapping keeps the file alive
+		if (p == MAP_FAILED)
+			throw std::system_error(err, std::generic_category(), "ctq: spill segment");
+		return segment{static_cast<std::byte*>(p), capacity};
+	}
+
+	static void unmap(segment& s) {
+		::munmap(s.data, s.capacity);
+	}
+#else
+	segment map(size_t /*capacity*/) const {
+		throw std::system_error(std::make_error_code(std::errc::function_not_supported), "ctq: spilling requires Linux");
+	}
+
+	static void unmap(segment& /*s*/) {}
+#endif
+
+	std::filesystem::path dir_;
+	size_t segment_size_;
+	std::deque<segment> segments_; // oldest first, records are appended to the last one
+	size_t count_{};
+};
+
+} // namespace detail
+
+} // namespace ctq
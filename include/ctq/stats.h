@@ -0,0 +1,272 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <ctq/cache_line.h>
+#include <ctq/histogram.h>
+
+namespace ctq {
+
+/** @brief Statistics policy which records nothing
+ *
+ * This is the default policy of basic_task_queue. Every hook is an empty inline function
+ * and time points are empty structs, so an uninstrumented queue does not read the clock
+ * and pays nothing for the instrumentation points.
+ */
+struct no_stats {
+	static constexpr bool enabled = false;
+	struct time_point {};
+
+	explicit no_stats(size_t /*workers*/) {}
+
+	time_point now() const { return {}; }
+	void on_push(size_t /*depth*/) {}
+	void on_blocked(time_point /*since*/) {}
+	time_point on_pop() { return {}; }
+	template<typename Item>
+	time_point on_dequeue(size_t /*worker*/, time_point /*idle_since*/, time_point /*enqueued*/, const Item& /*item*/) { return {}; }
+	void on_done(size_t /*worker*/, time_point /*start*/) {}
+	void on_access(size_t /*depth*/) {}
+};
+
+/** @brief Statistics policy which records queue and worker metrics
+ *
+ * Use as the Stats parameter of basic_task_queue, e.g.
+ * ctq::basic_task_queue<std::vector<int>, ctq::queue_stats>, and read the metrics with stats().
+ * Producer counters are plain atomics, written by the push hooks under the queue mutex,
+ * and every worker owns its own cache line of counters and latency histogram; everything
+ * is merged only when a snapshot is taken.
+ * Items taken outside the workers (e.g. by async_pop()) are recorded in one extra slot, with
+ * index workers, which counts towards the totals but is not listed in workers.
+ * Hooks marked "locked" are called with the queue mutex held.
+ */
+struct queue_stats {
+	static constexpr bool enabled = true;
+	using clock = std::chrono::steady_clock;
+	using time_point = clock::time_point;
+
+	struct worker_snapshot {
+		uint64_t dequeued{};
+		std::chrono::nanoseconds idle_time{};
+		std::chrono::nanoseconds busy_time{};
+	};
+
+	struct snapshot_type {
+		uint64_t enqueued{};
+		uint64_t dequeued{};
+		size_t depth{};      // items in the queue when the snapshot was taken
+		size_t high_water{}; // maximum depth seen so far
+		uint64_t blocked_pushes{};           // pushes which waited for room in a bounded queue
+		std::chrono::nanoseconds blocked_time{}; // total time producers spent waiting
+		std::chrono::nanoseconds idle_time{};    // total time workers spent waiting for items
+		std::chrono::nanoseconds busy_time{};    // total time workers spent in the callback
+		histogram latency; // time an item spent in the queue, in nanoseconds
+		std::vector<worker_snapshot> workers;
+	};
+
+	explicit queue_stats(size_t workers)
+		: workers_(workers)
+		  ,slots_(std::make_unique<worker_slot[]>(workers + 1))
+	{ }
+
+	time_point now() const {
+		return clock::now();
+	}
+
+	// locked
+	void on_push(size_t depth) {
+		stamps_.push_back(now());
+		bump(enqueued_, 1);
+		if (depth > high_water_.load(std::memory_order_relaxed))
+			high_water_.store(depth, std::memory_order_relaxed);
+	}
+
+	// locked
+	void on_blocked(time_point since) {
+		bump(blocked_pushes_, 1);
+		bump(blocked_ns_, to_ns(now() - since));
+	}
+
+	// locked, returns the time the popped item was pushed
+	time_point on_pop() {
+		if (stamps_.empty())
+			return now();
+		auto t = stamps_.front();
+		stamps_.pop_front();
+		return t;
+	}
+
+	// returns the time the callback is started
+	template<typename Item>
+	time_point on_dequeue(size_t worker, time_point idle_since, time_point enqueued, const Item& /*item*/) {
+		auto start = now();
+		auto& s = slots_[worker];
+		s.dequeued.fetch_add(1, std::memory_order_relaxed);
+		s.idle_ns.fetch_add(to_ns(start - idle_since), std::memory_order_relaxed);
+		s.latency.record(to_ns(start - enqueued));
+		return start;
+	}
+
+	// returns the time spent in the callback, in nanoseconds
+	uint64_t on_done(size_t worker, time_point start) {
+		auto busy = to_ns(now() - start);
+		slots_[worker].busy_ns.fetch_add(busy, std::memory_order_relaxed);
+		return busy;
+	}
+
+	// locked, called after the queue was accessed directly and may have changed size
+	void on_access(size_t depth) {
+		while (stamps_.size() > depth)
+			stamps_.pop_front();
+		while (stamps_.size() < depth)
+			stamps_.push_back(now());
+	}
+
+	snapshot_type snapshot() const {
+		snapshot_type s;
+		s.enqueued = enqueued_.load(std::memory_order_relaxed);
+		s.high_water = high_water_.load(std::memory_order_relaxed);
+		s.blocked_pushes = blocked_pushes_.load(std::memory_order_relaxed);
+		s.blocked_time = std::chrono::nanoseconds(blocked_ns_.load(std::memory_order_relaxed));
+		s.workers.reserve(workers_);
+		for (size_t i = 0; i <= workers_; ++i) {
+			auto& slot = slots_[i];
+			worker_snapshot w;
+			w.dequeued = slot.dequeued.load(std::memory_order_relaxed);
+			w.idle_time = std::chrono::nanoseconds(slot.idle_ns.load(std::memory_order_relaxed));
+			w.busy_time = std::chrono::nanoseconds(slot.busy_ns.load(std::memory_order_relaxed));
+			s.dequeued += w.dequeued;
+			s.idle_time += w.idle_time;
+			s.busy_time += w.busy_time;
+			if (i < workers_)
+				s.workers.push_back(w);
+			slot.latency.merge_into(s.latency);
+		}
+		return s;
+	}
+
+protected:
+	static uint64_t to_ns(clock::duration d) {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+	}
+
+private:
+	// a counter written under the queue mutex only: no read-modify-write needed
+	static void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	struct alignas(detail::cache_line_size) worker_slot {
+		std::atomic<uint64_t> dequeued{};
+		std::atomic<uint64_t> idle_ns{};
+		std::atomic<uint64_t> busy_ns{};
+		histogram_recorder latency;
+	};
+
+	size_t workers_;
+	std::unique_ptr<worker_slot[]> slots_;
+	std::atomic<uint64_t> enqueued_{};       // locked writes
+	std::atomic<uint64_t> blocked_pushes_{}; // locked writes
+	std::atomic<uint64_t> blocked_ns_{};     // locked writes
+	std::atomic<size_t> high_water_{};
+	std::deque<time_point> stamps_; // enqueue time of every queued item, front is the oldest
+};
+
+namespace detail {
+
+template<typename T, typename... Ts>
+constexpr size_t index_of() {
+	size_t i = 0;
+	bool found = ((std::is_same_v<T, Ts> ? true : (++i, false)) || ...);
+	return found ? i : sizeof...(Ts);
+}
+
+} // namespace detail
+
+/** @brief Statistics policy for std::variant<Ts...> items with a breakdown per alternative
+ *
+ * Records everything queue_stats does and, for every alternative of Ts, a histogram of the
+ * time items spent in the queue (dwell) and of the time spent in the callback (execution).
+ * Each worker writes its own per-type recorders without locks, snapshot() merges them.
+ * Selected by task_queue<Container, instrumented<Ts...>>.
+ */
+template<typename... Ts>
+struct type_stats : queue_stats {
+	static constexpr size_t type_count = sizeof...(Ts);
+
+	struct token {
+		time_point start;
+		size_t index;
+	};
+
+	struct type_snapshot {
+		histogram dwell_time; // time in the queue, ns
+		histogram exec_time;  // time in the callback, ns
+
+		uint64_t count() const {
+			return exec_time.count();
+		}
+	};
+
+	struct snapshot_type : queue_stats::snapshot_type {
+		std::array<type_snapshot, type_count> types;
+
+		template<typename T>
+		const type_snapshot& of() const {
+			static_assert(detail::index_of<T, Ts...>() < type_count, "T is not one of the queue types");
+			return types[detail::index_of<T, Ts...>()];
+		}
+	};
+
+	explicit type_stats(size_t workers)
+		: queue_stats(workers)
+		  ,workers_(workers)
+		  ,slots_(std::make_unique<worker_slot[]>(workers + 1))
+	{ }
+
+	template<typename Item>
+	token on_dequeue(size_t worker, time_point idle_since, time_point enqueued, const Item& item) {
+		auto start = queue_stats::on_dequeue(worker, idle_since, enqueued, item);
+		auto i = item.index();
+		slots_[worker].types[i].dwell.record(to_ns(start - enqueued));
+		return {start, i};
+	}
+
+	void on_done(size_t worker, token t) {
+		slots_[worker].types[t.index].exec.record(queue_stats::on_done(worker, t.start));
+	}
+
+	snapshot_type snapshot() const {
+		snapshot_type s;
+		static_cast<queue_stats::snapshot_type&>(s) = queue_stats::snapshot();
+		for (size_t w = 0; w <= workers_; ++w) {
+			for (size_t i = 0; i < type_count; ++i) {
+				slots_[w].types[i].dwell.merge_into(s.types[i].dwell_time);
+				slots_[w].types[i].exec.merge_into(s.types[i].exec_time);
+			}
+		}
+		return s;
+	}
+
+private:
+	struct type_slot {
+		histogram_recorder dwell;
+		histogram_recorder exec;
+	};
+
+	struct alignas(detail::cache_line_size) worker_slot {
+		std::array<type_slot, type_count> types;
+	};
+
+	size_t workers_;
+	std::unique_ptr<worker_slot[]> slots_;
+};
+
+} // namespace ctq
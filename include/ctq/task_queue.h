@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stop_token>
+#include <chrono>
 #include <variant>
 #include <type_traits>
 #include <mutex>
@@ -8,10 +9,33 @@
 #include <functional>
 #include <optional>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
 #include <thread>
 #include <utility>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <ranges>
+#include <filesystem>
+#include <span>
 
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <ctq/cache_line.h>
 #include <ctq/circular_buffer.h>
+#include <ctq/coroutine.h>
+#include <ctq/error_policy.h>
+#include <ctq/fair_scheduler.h>
+#include <ctq/future.h>
+#include <ctq/spill.h>
+#include <ctq/stats.h>
 
 namespace ctq {
 
@@ -34,6 +58,15 @@ struct queue_adapter : Container{
 	std::optional<size_t> max_elements() const {
 		return max_elements_;
 	}
+
+	bool full() const {
+		return max_elements_ && this->size() >= *max_elements_;
+	}
+
+	// the front item can be taken
+	bool ready() const {
+		return !this->empty();
+	}
 };
 
 template<typename T>
@@ -51,41 +84,501 @@ struct queue_adapter<std::vector<T>> : std::vector<T>
 		return max_elements_;
 	}
 
+	bool full() const {
+		return max_elements_ && this->size() >= *max_elements_;
+	}
+
+	bool ready() const {
+		return !this->empty();
+	}
+
 	void pop_front() {
 		this->erase(this->begin());
 	}
 };
 
+	/** @brief Adapter for circular_buffer, adding slots written and read in place
+	 *
+	 * Besides push_back, a slot can be reserved, written by the producer without the queue
+	 * lock and committed; items become ready in queue order, a reserved front holds back the
+	 * ones behind it. A consumer can likewise acquire the front slot and release it once done,
+	 * the slot is not reused until then. Slots taken by in-place consumers stay allocated:
+	 * the slots from the oldest unreleased one up to the front are counted by full().
+	 */
 template<typename T>
 struct queue_adapter<circular_buffer<T>> : circular_buffer<T>
 {
-	explicit queue_adapter(std::optional<size_t> max_elements) : circular_buffer<T>(*max_elements) {}
+	using base = circular_buffer<T>;
+
+	explicit queue_adapter(std::optional<size_t> max_elements)
+		: base(*max_elements)
+		  ,state_(*max_elements, slot_state::free)
+	{}
 
 	std::optional<size_t> max_elements() const {
 		return this->capacity();
 	}
 
+	bool full() const {
+		return this->size() + held_ >= this->capacity();
+	}
+
+	bool ready() const {
+		return !this->empty() && state_[this->front_index()] == slot_state::committed;
+	}
+
+	void push_back(T&& v) {
+		state_[this->back_index()] = slot_state::committed;
+		base::push_back(std::move(v));
+	}
+
+	template<typename... Args>
+	void emplace_back(Args&&... args) {
+		state_[this->back_index()] = slot_state::committed;
+		base::emplace_back(std::forward<Args>(args)...);
+	}
+
+	void pop_front() {
+		state_[this->front_index()] = slot_state::free;
+		advance();
+	}
+
+	T next() {
+		T v = std::move(this->front());
+		pop_front();
+		return v;
+	}
+
+	// claim the next slot for an in-place write, returns its index
+	size_t reserve() {
+		auto i = this->back_index();
+		state_[i] = slot_state::reserved;
+		this->claim_back();
+		return i;
+	}
+
+	void commit(size_t i) {
+		state_[i] = slot_state::committed;
+	}
+
+	// give a reserved slot up, it is skipped when it reaches the front
+	void cancel(size_t i) {
+		state_[i] = slot_state::abandoned;
+		skip_abandoned();
+	}
+
+	// take the (ready) front slot for an in-place read, returns its index
+	size_t acquire_front() {
+		auto i = this->front_index();
+		state_[i] = slot_state::reading;
+		base::pop_front();
+		++held_;
+		skip_abandoned();
+		return i;
+	}
+
+	// i-th slot from the front holds a committed item
+	bool committed(size_t i) const {
+		return state_[(this->front_index() + i) % this->capacity()] == slot_state::committed;
+	}
+
+	void release(size_t i) {
+		state_[i] = slot_state::free;
+		// reclaim the released slots at the tail of the held ones
+		auto n = this->capacity();
+		while (held_ > 0 && state_[(this->front_index() + n - held_) % n] == slot_state::free)
+			--held_;
+	}
+
+private:
+	enum class slot_state : unsigned char { free, reserved, committed, abandoned, reading };
+
+	void advance() {
+		base::pop_front();
+		if (held_ > 0)
+			++held_; // the freed slot lies behind a held one, it is reclaimed with it
+		skip_abandoned();
+	}
+
+	void skip_abandoned() {
+		while (!this->empty() && state_[this->front_index()] == slot_state::abandoned) {
+			state_[this->front_index()] = slot_state::free;
+			base::pop_front();
+			if (held_ > 0)
+				++held_;
+		}
+	}
+
+	std::vector<slot_state> state_;
+	size_t held_{}; // slots from the oldest one being read up to the front
+};
+
+// remove the front item and return it, through next() for containers which have one
+template<typename Q>
+typename Q::value_type take_front(Q& q) {
+	if constexpr (requires { q.next(); }) {
+		return q.next();
+	} else {
+		auto item = std::move(q.front());
+		q.pop_front();
+		return item;
+	}
+}
+
+template<typename Q>
+concept indexable = requires(Q& q, size_t i) {
+	{ q[i] } -> std::same_as<typename Q::value_type&>;
+};
+
+	/** @brief Key -> sequence number map of the queued items, see basic_task_queue::set_conflation() */
+template<typename T>
+struct conflation_index {
+	virtual ~conflation_index() = default;
+	// sequence number of the queued item with the key of item
+	virtual std::optional<uint64_t> find(const T& item) = 0;
+	virtual void add(const T& item, uint64_t seq) = 0;
+	// item left the queue, forget its key unless a later item replaced it
+	virtual void remove(const T& item, uint64_t seq) = 0;
+	virtual void merge(T& queued, T&& incoming) = 0;
+	virtual void clear() = 0;
+};
+
+template<typename T, typename Key, typename KeyFn, typename MergeFn>
+struct keyed_index final : conflation_index<T> {
+	keyed_index(KeyFn key, MergeFn merge) : key_(std::move(key)), merge_(std::move(merge)) {}
+
+	std::optional<uint64_t> find(const T& item) override {
+		auto it = seq_.find(key_(item));
+		if (it == seq_.end())
+			return std::nullopt;
+		return it->second;
+	}
+
+	void add(const T& item, uint64_t seq) override {
+		seq_[key_(item)] = seq;
+	}
+
+	void remove(const T& item, uint64_t seq) override {
+		auto it = seq_.find(key_(item));
+		if (it != seq_.end() && it->second == seq)
+			seq_.erase(it);
+	}
+
+	void merge(T& queued, T&& incoming) override {
+		merge_(queued, std::move(incoming));
+	}
+
+	void clear() override {
+		seq_.clear();
+	}
+
+private:
+	KeyFn key_;
+	MergeFn merge_;
+	std::unordered_map<Key, uint64_t> seq_;
+};
+
+// default conflation: the latest item wins
+struct replace_item {
+	template<typename T>
+	void operator()(T& queued, T&& incoming) const {
+		queued = std::move(incoming);
+	}
+};
+
+// call f on every queued item, in order where the container allows it
+template<typename Q, typename F>
+void for_each_item(Q& q, F&& f) {
+	if constexpr (indexable<Q>) {
+		for (size_t i = 0; i < q.size(); ++i)
+			f(q[i]);
+	} else if constexpr (std::ranges::range<Q>) {
+		for (auto& item : q)
+			f(item);
+	}
+}
+
+template<typename Q>
+concept reservable = requires(Q& q, size_t i) {
+	{ q.reserve() } -> std::same_as<size_t>;
+	q.commit(i);
+	q.acquire_front();
+	q.release(i);
+};
+
+// call f on every queued item, in order; reserved slots are not items yet
+template<typename Q, typename F>
+void for_each_committed(const Q& q, F&& f) {
+	if constexpr (reservable<Q>) {
+		for (size_t i = 0; i < q.size(); ++i) {
+			if (q.committed(i))
+				f(q[i]);
+		}
+	} else {
+		for (auto& item : q)
+			f(item);
+	}
+}
+
+// append copies of the queued items to out, in order
+template<typename Q, typename T>
+void copy_items(const Q& q, std::vector<T>& out) {
+	for_each_committed(q, [&](const T& item) { out.push_back(item); });
+}
+
+	/** @brief Readiness flag mirrored into an eventfd, see basic_task_queue::native_handle()
+	 *
+	 * The descriptor is readable while the queue holds items. Only transitions are written,
+	 * so a burst of pushes into a non-empty queue makes no system call at all.
+	 * Not used (fd < 0) until native_handle() is first called.
+	 */
+struct ready_signal {
+	int fd = -1;
+	bool raised = false;
+
+	ready_signal() = default;
+	ready_signal(const ready_signal&) = delete;
+	ready_signal& operator=(const ready_signal&) = delete;
+
+#if defined(__linux__)
+	~ready_signal() {
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	void open(bool ready) {
+		fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "ctq: eventfd");
+		update(ready);
+	}
+
+	void update(bool ready) {
+		if (fd < 0 || ready == raised)
+			return;
+		raised = ready;
+		if (ready) {
+			uint64_t one = 1;
+			[[maybe_unused]] auto r = ::write(fd, &one, sizeof(one));
+		} else {
+			uint64_t value;
+			[[maybe_unused]] auto r = ::read(fd, &value, sizeof(value));
+		}
+	}
+#else
+	void update(bool /*ready*/) {}
+#endif
 };
 
 } // namespace detail
 
 
+/** @brief What a push does when a bounded queue is full, see basic_task_queue::set_overflow() */
+enum class overflow {
+	block,       // wait for room (default)
+	drop_newest, // discard the pushed item
+	drop_oldest, // discard the oldest queued item to make room, i.e. overwrite the ring
+};
+
+/** @brief Handle of a pushed item, see basic_task_queue::push_cancellable() */
+struct ticket {
+	uint64_t id = 0; // sequence number of the item + 1, 0 when there is nothing to cancel
+
+	explicit operator bool() const {
+		return id != 0;
+	}
+};
+
 // Forward declaration of basic_task_queue
-template<typename Container>
+template<typename Container, typename Stats = no_stats>
 struct basic_task_queue;
 
-/** @brief Task queue type definition
- *
- * This struct defines a task queue that can hold messages of multiple types.
- * It uses std::variant to hold any of the specified types.
- * Example: ctq::task_queue<std::vector, int, std::string> for a task queue holding either integers or strings.
- *          In this example the underlying container is std::vector<std::variant<int, std::string>>.
- *
- * @tparam Container A template template parameter representing the container type (e.g., std::vector, std::list).
- * @tparam Ts A variadic list of types that the task queue can hold.
- */
-template<template<typename... U> class Container, typename... Ts>
-struct task_queue {
+namespace detail {
+
+	/** @brief Common part of the task_queue types
+	 *
+	 * Owns the basic_task_queue and forwards the queue operations to it. The task_queue
+	 * types only add the constructors adapting their callbacks.
+	 *
+	 * @tparam Container The container type, e.g. std::vector<std::variant<int, std::string>>.
+	 * @tparam Stats The statistics policy of the basic_task_queue.
+	 */
+template<typename Container, typename Stats>
+struct task_queue_base {
+    using type = typename Container::value_type;
+    using queue = Container;
+
+	~task_queue_base() = default;
+
+	/** @brief Add an item to the task queue
+	 *
+	 * This method adds an item to the task queue.
+	 *
+	 * @param item The item to be added to the queue.
+	 */
+	void push(type item) {
+		basic_->push(std::move(item));
+	}
+
+	/** @brief Emplace an item into the task queue. Same as push but constructs in place. */
+	template<typename... Args>
+	void emplace(Args&&... args) {
+		basic_->emplace(std::forward<Args>(args)...);
+	}
+
+	/** @brief Add the items of a range under one lock, see basic_task_queue::push_batch() */
+	template<typename It>
+	void push_batch(It first, It last) {
+		basic_->push_batch(first, last);
+	}
+
+	/** @brief co_await-able push, see basic_task_queue::async_push() */
+	template<scheduler S = inline_scheduler>
+	auto async_push(type item, S& sched = detail::default_scheduler) {
+		return basic_->async_push(std::move(item), sched);
+	}
+
+	/** @brief co_await-able pop, see basic_task_queue::async_pop() */
+	template<scheduler S = inline_scheduler>
+	auto async_pop(S& sched = detail::default_scheduler) {
+		return basic_->async_pop(sched);
+	}
+
+	/** This method provides access to the underlying queue. The provided function is executed 
+	 *  with a lock held on the queue to ensure thread safety.
+	 */
+	template<typename F>
+	void access_queue(F&& f) {
+		basic_->access_queue(std::forward<F>(f));
+	}
+
+	/** @brief Read-only access_queue(), see basic_task_queue */
+	template<typename F>
+	void access_queue(F&& f) const {
+		std::as_const(*basic_).access_queue(std::forward<F>(f));
+	}
+
+	/** @brief Number of queued items without taking the lock, see basic_task_queue::size() */
+	size_t size() const {
+		return basic_->size();
+	}
+
+	bool empty() const {
+		return basic_->empty();
+	}
+
+	size_t size_approx() const {
+		return basic_->size_approx();
+	}
+
+	/** @brief Workers waiting for an item, see basic_task_queue::idle_workers() */
+	size_t idle_workers() const {
+		return basic_->idle_workers();
+	}
+
+	/** @brief Copy of the queued items, see basic_task_queue::snapshot() */
+	auto snapshot() const {
+		return basic_->snapshot();
+	}
+
+	/** @brief Keep one queued item per key, see basic_task_queue::set_conflation() */
+	template<typename KeyFn, typename MergeFn = replace_item>
+	void set_conflation(KeyFn key, MergeFn merge = {}) {
+		basic_->set_conflation(std::move(key), std::move(merge));
+	}
+
+	/** @brief Number of pushes merged into a queued item */
+	uint64_t conflated() const {
+		return basic_->conflated();
+	}
+
+	/** @brief Add an item only if there is room, see basic_task_queue::try_push() */
+	bool try_push(type&& item) {
+		return basic_->try_push(std::move(item));
+	}
+
+	/** @brief Block, drop the newest or drop the oldest item when full, see basic_task_queue::set_overflow() */
+	void set_overflow(overflow mode, std::function<void(type&)> on_drop = {}) {
+		basic_->set_overflow(mode, std::move(on_drop));
+	}
+
+	/** @brief Number of items discarded by the overflow policy */
+	uint64_t dropped() const {
+		return basic_->dropped();
+	}
+
+	/** @brief Add an item which the workers discard after deadline, see basic_task_queue::push() */
+	void push(type item, std::chrono::steady_clock::time_point deadline) {
+		basic_->push(std::move(item), deadline);
+	}
+
+	/** @brief Handler of expired items, see basic_task_queue::set_expiry() */
+	void set_expiry(std::function<void(type&)> on_expire) {
+		basic_->set_expiry(std::move(on_expire));
+	}
+
+	/** @brief Number of items discarded after their deadline */
+	uint64_t expired() const {
+		return basic_->expired();
+	}
+
+	/** @brief Add an item which can be cancelled while queued, see basic_task_queue::push_cancellable() */
+	ticket push_cancellable(type item) {
+		return basic_->push_cancellable(std::move(item));
+	}
+
+	/** @brief Tombstone a queued item, see basic_task_queue::cancel() */
+	bool cancel(ticket t) {
+		return basic_->cancel(t);
+	}
+
+	/** @brief Number of cancelled items skipped */
+	uint64_t cancelled() const {
+		return basic_->cancelled();
+	}
+
+	/** @brief Spill to disk instead of blocking when full, see basic_task_queue::set_spill() */
+	void set_spill(std::filesystem::path dir, spill_codec<type> codec, size_t segment_size = 64 << 20) {
+		basic_->set_spill(std::move(dir), std::move(codec), segment_size);
+	}
+
+	/** @brief Number of queued items on disk */
+	size_t spilled() const {
+		return basic_->spilled();
+	}
+
+	/** @brief Bound the queue by the total weight of its items, see basic_task_queue::set_byte_budget() */
+	void set_byte_budget(size_t max_bytes, std::function<size_t(const type&)> weight) {
+		basic_->set_byte_budget(max_bytes, std::move(weight));
+	}
+
+	/** @brief Total weight of the queued items */
+	size_t queued_bytes() const {
+		return basic_->queued_bytes();
+	}
+
+	/** @brief Take the oldest failure kept by the error queue, see error_policy::queue() */
+	std::optional<task_error<type>> pop_error() {
+		return basic_->pop_error();
+	}
+
+	/** @brief Number of items whose callback failed after all retries */
+	uint64_t failed() const {
+		return basic_->failed();
+	}
+
+protected:
+	std::unique_ptr<basic_task_queue<queue, Stats>> basic_;
+};
+
+	/** @brief Implementation of the multi-type task_queue
+	 *
+	 * Adds the std::visit wrapper dispatching each alternative to its callback. The Stats
+	 * policy is passed on to basic_task_queue, it is no_stats for task_queue<Container, Ts...>
+	 * and type_stats for task_queue<Container, instrumented<Ts...>>.
+	 */
+template<template<typename... U> class Container, typename Stats, typename... Ts>
+struct variant_task_queue : task_queue_base<Container<std::variant<Ts...>>, Stats> {
     using type = std::variant<Ts...>;
     using queue = Container<type>;
 	using callbacks = std::tuple<std::function<void(Ts)>...>;
@@ -98,50 +591,64 @@ struct task_queue {
 	 * @param cb A tuple of callback functions, one for each type in Ts.
 	 * @param max_elements An optional maximum number of elements in the queue.
 	 * @param workers The number of worker threads to process the queue.
+	 * @param on_error What to do when a callback throws, see error_policy.
 	 */
-	task_queue(callbacks cb, std::optional<size_t> max_elements, size_t workers = 1)
+	variant_task_queue(callbacks cb, std::optional<size_t> max_elements, size_t workers = 1, error_policy<type> on_error = {})
 	{
-		basic_ = std::make_unique<basic_task_queue<queue>>(
+		this->basic_ = std::make_unique<basic_task_queue<queue, Stats>>(
 			[cb](type item) {
 				std::visit([cb](auto&& arg) {
 					using T = std::decay_t<decltype(arg)>;
 					auto& c = std::get<std::function<void(T)>>(cb);
 					c(std::forward<decltype(arg)>(arg));
 					}, item);
-			}, max_elements, workers);
+			}, max_elements, workers, std::move(on_error));
 	}
 
-	explicit task_queue(callbacks cb, size_t workers = 1)
-		:task_queue(cb, std::nullopt, workers)
+	explicit variant_task_queue(callbacks cb, size_t workers = 1)
+		:variant_task_queue(cb, std::nullopt, workers)
 	{ }
+};
 
-	~task_queue() = default;
+} // namespace detail
 
-	/** @brief Add an item to the task queue
-	 *
-	 * This method adds an item to the task queue.
-	 *
-	 * @param item The item to be added to the queue.
-	 */
-	void push(type item) {
-		basic_->push(std::move(item));
-	}
+/** @brief Task queue type definition
+ *
+ * This struct defines a task queue that can hold messages of multiple types.
+ * It uses std::variant to hold any of the specified types.
+ * Example: ctq::task_queue<std::vector, int, std::string> for a task queue holding either integers or strings.
+ *          In this example the underlying container is std::vector<std::variant<int, std::string>>.
+ *
+ * @tparam Container A template template parameter representing the container type (e.g., std::vector, std::list).
+ * @tparam Ts A variadic list of types that the task queue can hold.
+ */
+template<template<typename... U> class Container, typename... Ts>
+struct task_queue : detail::variant_task_queue<Container, no_stats, Ts...> {
+	using detail::variant_task_queue<Container, no_stats, Ts...>::variant_task_queue;
+};
 
-	/** @brief Emplace an item into the task queue. Same as push but constructs in place. */
-	template<typename... Args>
-	void emplace(Args&&... args) {
-		basic_->emplace(std::forward<Args>(args)...);
-	}
+/** @brief Tag selecting the instrumented multi-type task queue, see task_queue<Container, instrumented<Ts...>> */
+template<typename... Ts>
+struct instrumented {};
 
-	/** This method provides access to the underlying queue. The provided function is executed 
-	 *  with a lock held on the queue to ensure thread safety.
-	 */
-	void access_queue(std::function<void(queue&)> f) {
-		basic_->access_queue(f);
-	}
+/** @brief Multi-type task queue with per-type latency histograms
+ *
+ * Same as task_queue<Container, Ts...> but records, for every alternative of Ts, the time
+ * spent in the queue and the time spent in its callback.
+ * Example: ctq::task_queue<std::vector, ctq::instrumented<int, std::string>>, then
+ *          queue.stats().of<std::string>().exec_time.percentile(99).
+ *
+ * @tparam Container A template template parameter representing the container type (e.g., std::vector, std::list).
+ * @tparam Ts A variadic list of types that the task queue can hold.
+ */
+template<template<typename... U> class Container, typename... Ts>
+struct task_queue<Container, instrumented<Ts...>> : detail::variant_task_queue<Container, type_stats<Ts...>, Ts...> {
+	using detail::variant_task_queue<Container, type_stats<Ts...>, Ts...>::variant_task_queue;
 
-private:
-	std::unique_ptr<basic_task_queue<queue>> basic_;
+	/** @brief Snapshot of the queue statistics including the per-type histograms, see type_stats */
+	auto stats() const {
+		return this->basic_->stats();
+	}
 };
 
 /** @brief Task queue type definition for a single type
@@ -154,81 +661,247 @@ private:
  * @tparam T The type that the task queue will hold.
  */
 template<template<typename T, typename... U> class Container, typename T>
-struct task_queue<Container, T> {
+struct task_queue<Container, T> : detail::task_queue_base<Container<T>, no_stats> {
     using type = T;
     using queue = Container<type>;
 	using callback = std::function<void(T)>;
 
-	task_queue(callback cb, std::optional<size_t> max_elements, size_t workers = 1)
+	task_queue(callback cb, std::optional<size_t> max_elements, size_t workers = 1, error_policy<type> on_error = {})
 	{
-		basic_ = std::make_unique<basic_task_queue<queue>>(
-			[cb](type item) { cb(std::move(item)); }, max_elements, workers);
+		this->basic_ = std::make_unique<basic_task_queue<queue>>(
+			[cb](type item) { cb(std::move(item)); }, max_elements, workers, std::move(on_error));
 	}
 	explicit task_queue(callback cb, size_t workers = 1)
 		:task_queue(cb, std::nullopt, workers)
 	{ }
+};
 
-	~task_queue() = default;
-
-	void push(type item) {
-		basic_->push(std::move(item));
-	}
-
-	template<typename... Args>
-	void emplace(Args&&... args) {
-		basic_->emplace(std::forward<Args>(args)...);
-	}
-
-	/** This method provides access to the underlying queue. The provided function is executed 
-	 *  with a lock held on the queue to ensure thread safety.
-	 */
-	void access_queue(std::function<void(queue&)> f) {
-		basic_->access_queue(f);
-	}
+namespace detail {
 
-private:
-	std::unique_ptr<basic_task_queue<queue>> basic_;
+	/** @brief Item of a result-returning task queue: the argument and where to put the result */
+template<typename T, typename R>
+struct job {
+	T item;
+	promise<R> result; // empty for items added with push()
 };
 
-/** @brief A simple task queue implementation
+} // namespace detail
+
+/** @brief Task queue whose callback returns a result
+ *
+ * This struct defines a task queue for a callback of signature R(T), to be used as a compute pool.
+ * submit() returns a ctq::future<R> for every item, push() keeps fire-and-forget semantics.
+ * Example: ctq::task_queue<std::deque, double(int)> for a queue of integers processed into doubles.
+ *          In this example the underlying container is std::deque<detail::job<int, double>>.
+ * The queue methods take and pass T, the jobs are not exposed; access_queue(), conflation,
+ * spilling and the pop side, which would need them, are not available.
+ *
+ * @tparam Container A template template parameter representing the container type (e.g., std::vector, std::list).
+ * @tparam R The result type of the callback, may be void.
+ * @tparam T The type that the task queue will hold.
+ */
+template<template<typename... U> class Container, typename R, typename T>
+struct task_queue<Container, R(T)> : private detail::task_queue_base<Container<detail::job<T, R>>, no_stats> {
+private:
+	using base = detail::task_queue_base<Container<detail::job<T, R>>, no_stats>;
+	using job = detail::job<T, R>;
+
+public:
+    using type = T;
+	using result_type = R;
+    using queue = Container<job>;
+	using callback = std::function<R(T)>;
+
+	using base::size;
+	using base::empty;
+	using base::size_approx;
+	using base::idle_workers;
+	using base::dropped;
+	using base::expired;
+	using base::cancel;
+	using base::cancelled;
+	using base::queued_bytes;
+
+	task_queue(callback cb, std::optional<size_t> max_elements, size_t workers = 1)
+	{
+		this->basic_ = std::make_unique<basic_task_queue<queue>>(
+			[cb](detail::job<T, R> j) {
+				if (j.result) {
+					j.result.run(cb, std::move(j.item));
+				} else {
+					cb(std::move(j.item));
+				}
+			}, max_elements, workers);
+	}
+	explicit task_queue(callback cb, size_t workers = 1)
+		:task_queue(cb, std::nullopt, workers)
+	{ }
+
+	/** @brief Add an item to the task queue, discarding the result */
+	void push(type item) {
+		this->basic_->push(detail::job<T, R>{std::move(item), {}});
+	}
+
+	/** @brief Emplace an item into the task queue. Same as push but constructs the item in place. */
+	template<typename... Args>
+	void emplace(Args&&... args) {
+		this->basic_->emplace(detail::job<T, R>{T(std::forward<Args>(args)...), {}});
+	}
+
+	/** @brief Add the items of a range under one lock, discarding the results */
+	template<typename It>
+	void push_batch(It first, It last) {
+		std::vector<detail::job<T, R>> jobs;
+		for (; first != last; ++first)
+			jobs.push_back(detail::job<T, R>{std::move(*first), {}});
+		this->basic_->push_batch(jobs.begin(), jobs.end());
+	}
+
+	/** @brief Add an item to the task queue and get a future for the result of its callback
+	 *
+	 * An exception thrown by the callback is rethrown by future::get(). If the queue is
+	 * destroyed before the item is processed, get() throws std::future_error(broken_promise).
+	 *
+	 * @param item The item to be added to the queue.
+	 */
+	future<R> submit(type item) {
+		auto [p, f] = detail::make_promise<R>();
+		this->basic_->push(detail::job<T, R>{std::move(item), std::move(p)});
+		return std::move(f);
+	}
+
+	/** @brief Submit every item of a range and get a future for all the results, see when_all() */
+	template<typename It>
+	auto submit_all(It first, It last) {
+		std::vector<future<R>> futures;
+		for (; first != last; ++first)
+			futures.push_back(submit(*first));
+		return when_all(std::move(futures));
+	}
+
+	/** @brief Add an item only if there is room, see basic_task_queue::try_push(); untouched when rejected */
+	bool try_push(type&& item) {
+		job j{std::move(item), {}};
+		if (this->basic_->try_push(std::move(j)))
+			return true;
+		item = std::move(j.item);
+		return false;
+	}
+
+	/** @brief Add an item which the workers discard after deadline, discarding the result */
+	void push(type item, std::chrono::steady_clock::time_point deadline) {
+		this->basic_->push(job{std::move(item), {}}, deadline);
+	}
+
+	/** @brief Add an item which can be cancelled while queued, discarding the result */
+	ticket push_cancellable(type item) {
+		return this->basic_->push_cancellable(job{std::move(item), {}});
+	}
+
+	/** @brief co_await-able push, discarding the result, see basic_task_queue::async_push() */
+	template<scheduler S = inline_scheduler>
+	auto async_push(type item, S& sched = detail::default_scheduler) {
+		return this->basic_->async_push(job{std::move(item), {}}, sched);
+	}
+
+	/** @brief Copy of the queued items, oldest first */
+	std::vector<type> snapshot() const requires std::is_copy_constructible_v<type> {
+		std::vector<type> items;
+		std::as_const(*this->basic_).access_queue([&](const auto& q) {
+			detail::for_each_item(q, [&](const job& j) { items.push_back(j.item); });
+		});
+		return items;
+	}
+
+	/** @brief Block, drop the newest or drop the oldest item when full, see basic_task_queue::set_overflow() */
+	void set_overflow(overflow mode, std::function<void(type&)> on_drop = {}) {
+		this->basic_->set_overflow(mode, on_item(std::move(on_drop)));
+	}
+
+	/** @brief Handler of expired items, see basic_task_queue::set_expiry() */
+	void set_expiry(std::function<void(type&)> on_expire) {
+		this->basic_->set_expiry(on_item(std::move(on_expire)));
+	}
+
+	/** @brief Bound the queue by the total weight of its items, see basic_task_queue::set_byte_budget() */
+	void set_byte_budget(size_t max_bytes, std::function<size_t(const type&)> weight) {
+		this->basic_->set_byte_budget(max_bytes, [weight = std::move(weight)](const job& j) { return weight(j.item); });
+	}
+
+private:
+	// a handler of jobs calling f with the item, none if f is empty; a submitted job
+	// discarded this way breaks its promise
+	static std::function<void(job&)> on_item(std::function<void(type&)> f) {
+		if (!f)
+			return {};
+		return [f = std::move(f)](job& j) { f(j.item); };
+	}
+};
+
+/** @brief A simple task queue implementation
  *
  * This struct implements a simple task queue that processes items of a specified type using a provided callback function.
  * It does the actual work of managing the queue and worker threads. Multiple worker threads process items concurrently.
  *
  * @tparam Container The type of the underlying queue container.
+ * @tparam Stats The statistics policy, no_stats (default) records nothing, queue_stats enables stats().
  */
-template<typename Container>
+template<typename Container, typename Stats>
 struct basic_task_queue {
 	// adapt to the underlying container
 	using queue = detail::queue_adapter<Container>;
 	using type = typename queue::value_type;
 	using callback = std::function<void(type)>;
+	using stats_type = Stats;
 
-	basic_task_queue(callback cb, std::optional<size_t> max_elements, size_t workers = 1)
+	/** @brief Constructor for basic_task_queue
+	 *
+	 * @param cb The callback processing every item.
+	 * @param max_elements An optional maximum number of elements in the queue.
+	 * @param workers The number of worker threads to process the queue.
+	 * @param on_error What to do when the callback throws, see error_policy. By default the exception terminates the process.
+	 */
+	basic_task_queue(callback cb, std::optional<size_t> max_elements, size_t workers = 1, error_policy<type> on_error = {})
 		: cb_(std::move(cb))
+		  ,errors_(std::move(on_error))
+		  ,consumer_id_(workers)
 		  ,q_(max_elements)
+		  ,stats_(workers)
 	{
+		if (!std::is_copy_constructible_v<type> && errors_.keeps_item()) {
+			throw std::invalid_argument("ctq: retries and the error queue require a copy constructible item type");
+		}
 		for (size_t i = 0; i < workers; ++i) {
-			workers_.emplace_back([this](std::stop_token st) {
-				while (!st.stop_requested()) {
-					std::optional<type> item;
-					{
-						std::unique_lock lock(mutex_);
-						if (!cv_.wait(lock, st, [this]() { return !q_.empty(); })) {
-							return; // stop requested
-						}
-						item = std::move(q_.front());
-						q_.pop_front();
-						if (q_.max_elements().has_value()) {
-							cv_.notify_all();
-						}
-					}
-					cb_(std::move(*item));
-				}
-			});
+			workers_.emplace_back([this, i](std::stop_token st) { work(st, i); });
 		}
 	}
 
+	/** @brief Constructor for a queue processed by the workers of a shared fair_scheduler
+	 *
+	 * The queue has no threads of its own. It receives a share of the scheduler's workers
+	 * proportional to weight while it has items, see fair_scheduler.
+	 *
+	 * @param cb The callback processing every item.
+	 * @param max_elements An optional maximum number of elements in the queue.
+	 * @param sched The scheduler, which must outlive the queue.
+	 * @param weight Items run per round robin turn, relative to the other queues.
+	 * @param on_error What to do when the callback throws, see error_policy.
+	 */
+	basic_task_queue(callback cb, std::optional<size_t> max_elements, fair_scheduler& sched, size_t weight = 1, error_policy<type> on_error = {})
+		:basic_task_queue(std::move(cb), max_elements, 0, std::move(on_error))
+	{
+		source_.q = this;
+		sched.attach(source_, weight);
+	}
+
+	/** @brief Constructor for a queue without workers, consumed with pop() and friends
+	 *
+	 * @param max_elements An optional maximum number of elements in the queue.
+	 */
+	explicit basic_task_queue(std::optional<size_t> max_elements)
+		:basic_task_queue(callback{}, max_elements, 0)
+	{ }
+
 	basic_task_queue(const basic_task_queue&) = delete;
 	basic_task_queue(basic_task_queue&&) = delete;
 	const basic_task_queue& operator=(const basic_task_queue&) = delete;
@@ -243,46 +916,1226 @@ struct basic_task_queue {
 	 * @param item The item to be added to the queue.
 	 */
 	void push(type item) {
+		std::optional<detail::resumption> wake;
 		{
 			std::unique_lock lock(mutex_);
-			if (q_.max_elements().has_value()) {
-				cv_.wait(lock, [this]() { return q_.size() < q_.max_elements().value(); });
-			}
-			q_.push_back(std::move(item));
+			if (!push_locked(lock, item))
+				return; // merged into a queued item
+			wake = pushed_locked();
 		}
 		cv_.notify_one();
+		resume(wake);
 	}
 
 	/** @brief Emplace an item into the task queue. Same as push but constructs in place. */
 	template<typename... Args>
 	void emplace(Args&&... args) {
+		std::optional<detail::resumption> wake;
+		{
+			std::unique_lock lock(mutex_);
+			if (index_ || overflow_ != overflow::block || weight_ || spill_) {
+				// the item may be merged, dropped or spilled, construct it first
+				type item(std::forward<Args>(args)...);
+				if (!push_locked(lock, item))
+					return;
+			} else {
+				wait_for_room(lock);
+				q_.emplace_back(std::forward<Args>(args)...);
+				++push_seq_;
+				source_.notify();
+			}
+			wake = pushed_locked();
+		}
+		cv_.notify_one();
+		resume(wake);
+	}
+
+	/** @brief Add the items of a range, moved from, in order and under a single lock acquisition
+	 *
+	 * Same as push() for every item, but the workers are woken once for the batch instead of
+	 * once per item. A bounded queue which fills up blocks in the middle of the batch, like
+	 * push(), letting other threads in while it waits.
+	 * Example: q.push_batch(v.begin(), v.end())
+	 */
+	template<typename It>
+	void push_batch(It first, It last) {
+		std::vector<detail::resumption> wakes;
+		size_t pushed = 0;
+		{
+			std::unique_lock lock(mutex_);
+			for (; first != last; ++first) {
+				type item(std::move(*first));
+				if (pushed > 0 && !has_room(weight_locked(item)))
+					cv_.notify_all(); // the workers must drain what this batch has pushed so far
+				if (!push_locked(lock, item))
+					continue;
+				++pushed;
+				if (auto wake = pushed_locked())
+					wakes.push_back(*wake);
+			}
+		}
+		if (pushed == 1) {
+			cv_.notify_one();
+		} else if (pushed > 1) {
+			cv_.notify_all();
+		}
+		for (auto& w : wakes)
+			w.resume(w.handle);
+	}
+
+	/** @brief Add an item only if there is room, never blocks
+	 *
+	 * Rejects the item when the queue is full, whatever the overflow policy; the item is
+	 * moved from only if it was accepted (or merged, see set_conflation()).
+	 *
+	 * @return false if the queue was full.
+	 */
+	bool try_push(type&& item) {
+		std::optional<detail::resumption> wake;
 		{
 			std::unique_lock lock(mutex_);
-			if (q_.max_elements().has_value()) {
-				cv_.wait(lock, [this]() { return q_.size() < q_.max_elements().value(); });
+			if (index_ && conflate_locked(item))
+				return true;
+			auto w = weight_locked(item);
+			if (!spill_locked(item, w)) {
+				if (!has_room(w))
+					return false;
+				append_locked(std::move(item));
 			}
-			q_.emplace_back(std::forward<Args>(args)...);
+			wake = pushed_locked();
 		}
 		cv_.notify_one();
+		resume(wake);
+		return true;
+	}
+
+	/** @brief Choose what push() does when a bounded queue is full
+	 *
+	 * overflow::block (the default) waits for room. overflow::drop_newest discards the pushed
+	 * item and overflow::drop_oldest the oldest queued one, so producers never stall; on a
+	 * circular_buffer the latter overwrites the ring. Dropped items are passed to on_drop,
+	 * called with the queue lock held (it must not push into this queue), and counted by
+	 * dropped(). Also applies to emplace() and async_push(), not to try_push().
+	 */
+	void set_overflow(overflow mode, std::function<void(type&)> on_drop = {}) {
+		std::unique_lock lock(mutex_);
+		overflow_ = mode;
+		on_drop_ = std::move(on_drop);
+	}
+
+	/** @brief Number of items discarded by the overflow policy */
+	uint64_t dropped() const {
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+	/** @brief Add an item which is useless after deadline
+	 *
+	 * Same as push(), but a worker which takes the item after its deadline does not call the
+	 * callback: the item is passed to the expiry handler, if any (see set_expiry()), and
+	 * counted by expired(). Under overload the backlog of stale items is then skipped instead
+	 * of processed. Items taken with pop() and friends are returned whatever their deadline.
+	 * Deadlines are forgotten when access_queue() modifies the queue.
+	 *
+	 * @param item The item to be added to the queue.
+	 * @param deadline Time after which the item is not worth processing.
+	 * @throws std::logic_error if reserve() was used on the queue.
+	 */
+	void push(type item, std::chrono::steady_clock::time_point deadline) {
+		std::optional<detail::resumption> wake;
+		{
+			std::unique_lock lock(mutex_);
+			if (reserved_)
+				throw std::logic_error("ctq: deadlines cannot be used together with reserve()");
+			numbered_ = true;
+			if (!push_locked(lock, item))
+				return; // merged into a queued item, which keeps its own deadline
+			// entries of items taken in the meantime by a pull consumer
+			while (!deadlines_.empty() && deadlines_.front().first < pop_seq_)
+				deadlines_.pop_front();
+			deadlines_.emplace_back(push_seq_ - 1, deadline);
+			wake = pushed_locked();
+		}
+		cv_.notify_one();
+		resume(wake);
+	}
+
+	/** @brief Handle items found expired by the workers, see push(item, deadline)
+	 *
+	 * on_expire is called with the queue lock held, it must not push into this queue.
+	 */
+	void set_expiry(std::function<void(type&)> on_expire) {
+		std::unique_lock lock(mutex_);
+		on_expire_ = std::move(on_expire);
+	}
+
+	/** @brief Number of items discarded after their deadline */
+	uint64_t expired() const {
+		return expired_.load(std::memory_order_relaxed);
+	}
+
+	/** @brief Same as push(), returning a ticket for cancel()
+	 *
+	 * The ticket is empty if the item did not enter the queue on its own: merged into a
+	 * queued item (see set_conflation()) or discarded by the overflow policy.
+	 *
+	 * @throws std::logic_error if reserve() was used on the queue, its slots are not numbered.
+	 */
+	ticket push_cancellable(type item) {
+		std::optional<detail::resumption> wake;
+		ticket t;
+		{
+			std::unique_lock lock(mutex_);
+			if (reserved_)
+				throw std::logic_error("ctq: push_cancellable() cannot be used together with reserve()");
+			numbered_ = true;
+			if (!push_locked(lock, item))
+				return t;
+			t.id = push_seq_; // the sequence number of the item is push_seq_ - 1
+			wake = pushed_locked();
+		}
+		cv_.notify_one();
+		resume(wake);
+		return t;
+	}
+
+	/** @brief Cancel a queued item in O(1)
+	 *
+	 * The item is marked as a tombstone and stays in the queue, still counted by size(), until
+	 * it reaches the front: it is then discarded without calling the callback or being popped.
+	 * A tombstone at the front is discarded at once, making room for blocked producers.
+	 * On a conflating queue its key is released, a later push with that key is queued anew.
+	 * Tickets issued before access_queue() modified the queue no longer match any item.
+	 *
+	 * @return false if the item was already taken by a consumer, discarded or cancelled.
+	 */
+	bool cancel(ticket t) {
+		std::vector<detail::resumption> wakes;
+		{
+			std::unique_lock lock(mutex_);
+			if (!t)
+				return false;
+			auto seq = t.id - 1;
+			if (seq < pop_seq_ || seq >= push_seq_ || !cancelled_.insert(seq).second)
+				return false;
+			// a later push with the same key is queued again rather than merged into the tombstone
+			if constexpr (detail::indexable<queue>) {
+				if (index_)
+					index_->remove(q_[seq - pop_seq_], seq);
+			}
+			if (seq != pop_seq_)
+				return true;
+			skip_cancelled_locked();
+			settle_locked(wakes);
+		}
+		cv_.notify_all();
+		for (auto& w : wakes)
+			w.resume(w.handle);
+		return true;
+	}
+
+	/** @brief Number of cancelled items discarded */
+	uint64_t cancelled() const {
+		return skipped_.load(std::memory_order_relaxed);
+	}
+
+	/** @brief Bound the queue by the total weight of its items, e.g. their size in bytes
+	 *
+	 * Used instead of, or together with, max_elements when items vary a lot in size. A push
+	 * needs room for weight(item) within max_bytes: it blocks, drops or is rejected exactly
+	 * as for a full queue (see set_overflow() and try_push()). An item heavier than the whole
+	 * budget is accepted once the queue is empty. weight is called with the queue lock held,
+	 * when an item is added and again when it leaves, so it must return the same value for an
+	 * item which was not changed in between; it is also applied to the items already queued.
+	 * Items written with reserve() are weighed at commit() and do not wait for the budget.
+	 *
+	 * The container must be iterable, or a circular_buffer, to weigh the queued items.
+	 *
+	 * Example: q.set_byte_budget(64 << 20, [](const std::string& s) { return s.size(); });
+	 */
+	void set_byte_budget(size_t max_bytes, std::function<size_t(const type&)> weight)
+		requires detail::reservable<queue> || std::ranges::range<const queue>
+	{
+		{
+			std::unique_lock lock(mutex_);
+			max_bytes_ = max_bytes;
+			weight_ = std::move(weight);
+			recount_bytes_locked();
+		}
+		cv_.notify_all(); // a larger budget may let blocked producers in
+	}
+
+	/** @brief Total weight of the queued items, see set_byte_budget() */
+	size_t queued_bytes() const {
+		std::unique_lock lock(mutex_);
+		return bytes_;
+	}
+
+	/** @brief Spill to disk instead of blocking when the queue is full
+	 *
+	 * Once set, a push into a full queue neither blocks nor drops: the item is serialized with
+	 * codec.encode and appended to memory-mapped segment files in dir. From then on every push
+	 * goes to disk, to keep the order, until the workers have caught up: whenever an item
+	 * leaves the queue, spilled items are decoded back into the room it freed. The items in
+	 * memory stay bounded by max_elements and the byte budget, none is lost, and producers run
+	 * at the speed of the disk at worst. size() counts the spilled items, spilled() only those.
+	 *
+	 * Applies to push(), emplace(), push_batch(), try_push() and async_push(), in place of the
+	 * overflow policy. Tickets and deadlines follow the items to disk and back. access_queue()
+	 * sees the items in memory only. The segment files have no name and are freed as they are
+	 * read, so spilling does not make the queue persistent across restarts. Linux only.
+	 *
+	 * Example:
+	 *   q.set_spill("/var/spool/orders", {
+	 *       [](const order& o, std::vector<std::byte>& out) { o.serialize(out); },
+	 *       [](std::span<const std::byte> in) { return order::parse(in); }});
+	 *
+	 * @param dir Directory of the segment files, on a file system supporting O_TMPFILE.
+	 * @param codec Converts items to bytes and back, see spill_codec.
+	 * @param segment_size Size of a segment file, a larger item gets a segment of its own.
+	 * @throws std::invalid_argument if the queue is unbounded.
+	 * @throws std::logic_error if the queue is not empty, conflates or used reserve().
+	 */
+	void set_spill(std::filesystem::path dir, spill_codec<type> codec, size_t segment_size = 64 << 20) {
+		std::unique_lock lock(mutex_);
+		if (!bounded())
+			throw std::invalid_argument("ctq: set_spill() requires a bounded queue");
+		if (index_ || reserved_)
+			throw std::logic_error("ctq: set_spill() cannot be used on a conflating queue or together with reserve()");
+		if (q_.size() != 0)
+			throw std::logic_error("ctq: set_spill() must be called on an empty queue");
+		codec_ = std::move(codec);
+		spill_ = std::make_unique<detail::spill_file>(std::move(dir), segment_size);
+	}
+
+	/** @brief Number of queued items currently on disk, see set_spill() */
+	size_t spilled() const {
+		std::unique_lock lock(mutex_);
+		return spill_ ? spill_->size() : 0;
+	}
+
+	/** @brief Conflate items with the same key: keep one queued item per key
+	 *
+	 * Once set, a push whose key matches an item still in the queue does not append: the
+	 * queued item is updated in place with merge(queued, std::move(incoming)), which by
+	 * default replaces it, and keeps its position. Such a push never blocks and does not
+	 * wake a consumer. The depth is then bounded by the number of distinct keys, e.g. one
+	 * pending price tick per symbol. An item which is already being processed is not
+	 * affected, the next push for its key is queued again.
+	 *
+	 * The queued items are located through a key -> sequence number index, so the container
+	 * needs random access (std::vector, std::deque, circular_buffer). Keys already queued
+	 * are indexed when this is called; cannot be combined with reserve().
+	 *
+	 * @param key Returns the key of an item, called with the queue lock held.
+	 * @param merge Updates the queued item with the incoming one, called with the queue lock held.
+	 * @throws std::logic_error if reserve() was used on the queue, its slots are not numbered.
+	 */
+	template<typename KeyFn, typename MergeFn = detail::replace_item>
+	void set_conflation(KeyFn key, MergeFn merge = {}) requires detail::indexable<queue> {
+		using key_type = std::decay_t<std::invoke_result_t<KeyFn&, const type&>>;
+		std::unique_lock lock(mutex_);
+		if (spill_)
+			throw std::logic_error("ctq: set_conflation() cannot be used on a spilling queue");
+		if (reserved_)
+			throw std::logic_error("ctq: set_conflation() cannot be used together with reserve()");
+		index_ = std::make_unique<detail::keyed_index<type, key_type, KeyFn, MergeFn>>(std::move(key), std::move(merge));
+		reindex_locked();
+	}
+
+	/** @brief Number of pushes merged into a queued item, see set_conflation() */
+	uint64_t conflated() const {
+		return conflated_.load(std::memory_order_relaxed);
+	}
+
+	/** @brief Take the oldest item, waiting until there is one
+	 *
+	 * The pull side of the queue, meant for workers = 0, e.g. to drain the queue from a reactor
+	 * loop. Items taken this way are not passed to the callback. A bounded queue wakes blocked
+	 * producers as it does for the workers.
+	 */
+	type pop() {
+		std::optional<detail::resumption> wake;
+		std::optional<type> item;
+		{
+			std::unique_lock lock(mutex_);
+			cv_.wait(lock, [this]() { return q_.ready(); });
+			item.emplace(pop_locked(wake));
+		}
+		resume(wake);
+		return std::move(*item);
+	}
+
+	/** @brief Take the oldest item if there is one, never blocks */
+	std::optional<type> try_pop() {
+		std::optional<detail::resumption> wake;
+		std::optional<type> item;
+		{
+			std::unique_lock lock(mutex_);
+			if (!q_.ready())
+				return std::nullopt;
+			item.emplace(pop_locked(wake));
+		}
+		resume(wake);
+		return item;
+	}
+
+	/** @brief Take the oldest item, waiting at most timeout for one */
+	template<typename Rep, typename Period>
+	std::optional<type> pop_for(std::chrono::duration<Rep, Period> timeout) {
+		std::optional<detail::resumption> wake;
+		std::optional<type> item;
+		{
+			std::unique_lock lock(mutex_);
+			if (!cv_.wait_for(lock, timeout, [this]() { return q_.ready(); }))
+				return std::nullopt;
+			item.emplace(pop_locked(wake));
+		}
+		resume(wake);
+		return item;
+	}
+
+	/** @brief Take up to n items at once without blocking
+	 *
+	 * The items are written to out in queue order under a single lock acquisition.
+	 * Example: q.pop_batch(std::back_inserter(v), 64)
+	 *
+	 * @return The number of items taken, 0 if the queue was empty.
+	 */
+	template<typename OutputIt>
+	size_t pop_batch(OutputIt out, size_t n) {
+		std::vector<detail::resumption> wakes;
+		size_t taken = 0;
+		{
+			std::unique_lock lock(mutex_);
+			for (; taken < n && q_.ready(); ++taken) {
+				std::optional<detail::resumption> wake;
+				typename Stats::time_point enqueued;
+				type item = take_locked(wake, enqueued);
+				consumed_locked(item, enqueued);
+				*out++ = std::move(item);
+				if (wake)
+					wakes.push_back(*wake);
+			}
+			if (taken > 0 && bounded()) {
+				cv_.notify_all();
+			}
+		}
+		for (auto& w : wakes)
+			w.resume(w.handle);
+		return taken;
+	}
+
+	/** @brief A reserved queue slot, see reserve()
+	 *
+	 * Dereference it to write the item in place, then commit() to make it visible to the
+	 * consumers. A slot destroyed without commit() is given up and skipped.
+	 */
+	struct slot {
+		slot(slot&& o) noexcept : q_(std::exchange(o.q_, nullptr)), index_(o.index_) {}
+		slot(const slot&) = delete;
+		slot& operator=(const slot&) = delete;
+
+		~slot() {
+			if (q_)
+				q_->finish_write(index_, false);
+		}
+
+		type& operator*() const { return q_->q_.slot(index_); }
+		type* operator->() const { return &q_->q_.slot(index_); }
+
+		void commit() {
+			std::exchange(q_, nullptr)->finish_write(index_, true);
+		}
+
+	private:
+		friend basic_task_queue;
+		slot(basic_task_queue* q, size_t index) : q_(q), index_(index) {}
+
+		basic_task_queue* q_;
+		size_t index_;
+	};
+
+	/** @brief Reserve the next slot of a circular_buffer queue for an in-place write
+	 *
+	 * Blocks like push() while the queue is full. The slot already holds an object of the
+	 * item type (a previous item or a default constructed one): the producer overwrites it
+	 * through the returned handle without the queue lock, e.g. filling a preallocated
+	 * payload buffer, and publishes it with commit(). Items become visible in reservation
+	 * order, so a reserved but uncommitted slot holds back the ones pushed after it.
+	 *
+	 * Example:
+	 *   auto s = q.reserve();
+	 *   s->payload.assign(data, data + n); // reuses the capacity left by the previous item
+	 *   s.commit();
+	 */
+	slot reserve() requires detail::reservable<queue> {
+		std::unique_lock lock(mutex_);
+		if (index_)
+			throw std::logic_error("ctq: reserve() cannot be used on a conflating queue");
+		if (spill_)
+			throw std::logic_error("ctq: reserve() cannot be used on a spilling queue");
+		if (numbered_)
+			throw std::logic_error("ctq: reserve() cannot be used together with push_cancellable() or deadlines");
+		reserved_ = true;
+		wait_for_room(lock);
+		return slot(this, q_.reserve());
+	}
+
+	/** @brief Process the oldest item in place, waiting until there is one
+	 *
+	 * Calls f(type&) on the queue slot itself, without the lock, and frees the slot when f
+	 * returns: the item is neither copied nor moved out of the circular_buffer. The slot is
+	 * not reused while f runs, so a slow f holds back producers once the queue wraps around.
+	 * As for pop(), the callback is not called for items taken this way.
+	 */
+	template<typename F>
+	void consume(F&& f) requires detail::reservable<queue> {
+		std::unique_lock lock(mutex_);
+		cv_.wait(lock, [this]() { return q_.ready(); });
+		read_in_place(lock, f);
+	}
+
+	/** @brief consume() if an item is ready, returns false otherwise */
+	template<typename F>
+	bool try_consume(F&& f) requires detail::reservable<queue> {
+		std::unique_lock lock(mutex_);
+		if (!q_.ready())
+			return false;
+		read_in_place(lock, f);
+		return true;
+	}
+
+	/** @brief Awaitable returned by async_push() */
+	struct push_awaiter {
+		basic_task_queue& q;
+		type item;
+		detail::resumer resume;
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> h) { return q.suspend_push(h, *this); }
+		void await_resume() const noexcept {}
+	};
+
+	/** @brief Awaitable returned by async_pop() */
+	struct pop_awaiter {
+		basic_task_queue& q;
+		detail::resumer resume;
+		std::optional<type> item{};
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> h) { return q.suspend_pop(h, *this); }
+		type await_resume() { return std::move(*item); }
+	};
+
+	/** @brief Add an item from a coroutine: co_await q.async_push(item)
+	 *
+	 * Same as push(), but if the bounded queue is full the coroutine is suspended instead of
+	 * the thread. It is resumed through the scheduler once a consumer has made room, by then
+	 * the item is already in the queue. Suspended pushes are admitted in FIFO order. With a
+	 * dropping overflow policy (see set_overflow()) the push completes at once, as push() does.
+	 *
+	 * @param item The item to be added to the queue.
+	 * @param sched The scheduler resuming the coroutine, it must outlive the suspension.
+	 */
+	template<scheduler S = inline_scheduler>
+	push_awaiter async_push(type item, S& sched = detail::default_scheduler) {
+		return push_awaiter{*this, std::move(item), detail::resumer::of(sched)};
+	}
+
+	/** @brief Take an item from a coroutine: auto item = co_await q.async_pop()
+	 *
+	 * Lets a coroutine consume the queue instead of (or next to) the worker threads, e.g. with
+	 * workers = 0. If the queue is empty the coroutine is suspended and resumed through the
+	 * scheduler by the producer which pushes the next item, handed over directly to it.
+	 * The callback is not called for items taken this way.
+	 *
+	 * @param sched The scheduler resuming the coroutine, it must outlive the suspension.
+	 */
+	template<scheduler S = inline_scheduler>
+	pop_awaiter async_pop(S& sched = detail::default_scheduler) {
+		return pop_awaiter{*this, detail::resumer::of(sched)};
 	}
 
 	/** @brief Access the underlying queue
 	 *
 	 * This method provides access to the underlying queue. The provided function is executed 
-	 * with a lock held on the queue to ensure thread safety.
+	 * with a lock held on the queue to ensure thread safety. Producers and workers are blocked
+	 * while it runs; prefer size(), empty() or snapshot() to look at the queue.
 	 *
 	 * @param f A function that takes a reference to the queue and performs operations on it.
 	 */
-	void access_queue(std::function<void(queue&)> f) {
+	template<typename F>
+	void access_queue(F&& f) {
 		std::unique_lock lock(mutex_);
 		f(q_);
+		stats_.on_access(q_.size());
+		if (weight_)
+			recount_bytes_locked();
+		// positions may have changed, renumber the queued items; earlier tickets and
+		// deadlines are void
+		cancelled_.clear();
+		deadlines_.clear();
+		pop_seq_ = push_seq_;
+		push_seq_ += q_.size() + (spill_ ? spill_->size() : 0);
+		if (index_)
+			reindex_locked();
+		unspill_locked();
+		changed_locked();
+	}
+
+	/** @brief Read-only access to the underlying queue, under the lock
+	 *
+	 * Unlike the non-const overload nothing is recomputed afterwards, the lock is held for f only.
+	 */
+	template<typename F>
+	void access_queue(F&& f) const {
+		std::unique_lock lock(mutex_);
+		f(static_cast<const queue&>(q_));
+	}
+
+	/** @brief Number of queued items, without taking the lock
+	 *
+	 * The value of the last change, possibly stale by the time it is used.
+	 */
+	size_t size() const {
+		return gauges_.size.load(std::memory_order_relaxed);
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	/** @brief Same as size(), named for callers sampling the depth at a high rate, e.g. a load balancer */
+	size_t size_approx() const {
+		return size();
+	}
+
+	/** @brief Number of the queue's own workers currently waiting for an item, without taking the lock */
+	size_t idle_workers() const {
+		return gauges_.idle.load(std::memory_order_relaxed);
+	}
+
+	/** @brief Copy of the queued items, oldest first
+	 *
+	 * The lock is held only for the copy, into a vector allocated beforehand. Spilled items
+	 * are copied as records and decoded once the lock is released.
+	 */
+	std::vector<type> snapshot() const
+		requires std::is_copy_constructible_v<type> && (detail::reservable<queue> || std::ranges::range<const queue>)
+	{
+		std::vector<type> items;
+		items.reserve(size());
+		std::vector<std::byte> records;
+		std::vector<size_t> ends; // end of every record in records
+		decltype(codec_.decode) decode;
+		{
+			std::unique_lock lock(mutex_);
+			detail::copy_items(q_, items);
+			if (spill_ && !spill_->empty()) {
+				spill_->for_each([&](std::span<const std::byte> record) {
+					records.insert(records.end(), record.begin(), record.end());
+					ends.push_back(records.size());
+				});
+				decode = codec_.decode;
+			}
+		}
+		size_t begin = 0;
+		for (auto end : ends) {
+			items.push_back(decode(std::span<const std::byte>(records).subspan(begin, end - begin)));
+			begin = end;
+		}
+		return items;
+	}
+
+#if defined(__linux__)
+	/** @brief File descriptor which is readable while the queue holds items
+	 *
+	 * For pull mode (workers = 0) next to sockets in epoll/poll: wait for EPOLLIN, then take
+	 * items with try_pop() or pop_batch(). The eventfd is created by the first call, queues
+	 * which never call this make no system calls. It is written only when the queue goes from
+	 * empty to non-empty and drained by whoever takes the last item, so do not read it
+	 * yourself. Owned by the queue, valid until it is destroyed. Linux only.
+	 *
+	 * @throws std::system_error if the eventfd cannot be created.
+	 */
+	int native_handle() {
+		std::unique_lock lock(mutex_);
+		if (ready_.fd < 0)
+			ready_.open(q_.ready());
+		return ready_.fd;
+	}
+#endif
+
+	/** @brief Take the oldest failure kept by the error queue, see error_policy::queue() */
+	std::optional<task_error<type>> pop_error() {
+		std::unique_lock lock(errors_mutex_);
+		if (error_queue_.empty())
+			return std::nullopt;
+		auto e = std::move(error_queue_.front());
+		error_queue_.pop_front();
+		return e;
+	}
+
+	/** @brief Number of items whose callback failed after all retries */
+	uint64_t failed() const {
+		return failed_.load(std::memory_order_relaxed);
+	}
+
+	/** @brief Snapshot of the queue statistics
+	 *
+	 * Only available with an enabled statistics policy, e.g. queue_stats. Counters are
+	 * merged from the per-thread and per-worker records without blocking producers or workers.
+	 */
+	auto stats() const requires Stats::enabled {
+		auto s = stats_.snapshot();
+		s.depth = size();
+		return s;
 	}
 
 private:
+	// the queue as seen by a fair_scheduler, notify() is called with the queue lock held
+	struct scheduled_source final : detail::fair_source {
+		basic_task_queue* q = nullptr;
+
+		~scheduled_source() {
+			detach();
+		}
+
+		bool run_one(std::stop_token st) override {
+			return q->run_scheduled(st);
+		}
+	};
+
+	// run one item on a scheduler worker, recorded in the statistics of external consumers
+	bool run_scheduled(std::stop_token st) {
+		std::optional<type> item;
+		std::optional<detail::resumption> wake;
+		auto idle_since = stats_.now();
+		typename Stats::time_point enqueued;
+		{
+			std::unique_lock lock(mutex_);
+			if (!q_.ready())
+				return false;
+			auto seq = pop_seq_;
+			item = take_locked(wake, enqueued);
+			if (bounded()) {
+				cv_.notify_all();
+			}
+			if (expire_locked(seq, *item))
+				item.reset();
+		}
+		resume(wake);
+		if (!item)
+			return true;
+		auto dispatch = stats_.on_dequeue(consumer_id_, idle_since, enqueued, *item);
+		run(std::move(*item), st);
+		stats_.on_done(consumer_id_, dispatch);
+		return true;
+	}
+
+	void work(std::stop_token st, size_t id) {
+		while (!st.stop_requested()) {
+			std::optional<type> item;
+			std::optional<detail::resumption> wake;
+			auto idle_since = stats_.now();
+			typename Stats::time_point enqueued;
+			bool stale;
+			{
+				std::unique_lock lock(mutex_);
+				if (!q_.ready()) {
+					gauges_.idle.fetch_add(1, std::memory_order_relaxed);
+					bool woken = cv_.wait(lock, st, [this]() { return q_.ready(); });
+					gauges_.idle.fetch_sub(1, std::memory_order_relaxed);
+					if (!woken) {
+						return; // stop requested
+					}
+				}
+				auto seq = pop_seq_;
+				item = take_locked(wake, enqueued);
+				if (bounded()) {
+					cv_.notify_all();
+				}
+				stale = expire_locked(seq, *item);
+			}
+			resume(wake);
+			if (stale)
+				continue;
+			auto dispatch = stats_.on_dequeue(id, idle_since, enqueued, *item);
+			run(std::move(*item), st);
+			stats_.on_done(id, dispatch);
+		}
+	}
+
+	// call the callback, applying the error policy
+	void run(type&& item, std::stop_token st) {
+		if (!errors_.catches()) {
+			cb_(std::move(item));
+			return;
+		}
+		for (size_t attempt = 1;; ++attempt) {
+			bool retry = attempt <= errors_.retries;
+			if constexpr (std::is_copy_constructible_v<type>) {
+				// the callback gets a copy only when a failure still needs the item: for a retry,
+				// the error queue, or the handler, which sees it whenever items are kept
+				if (retry || errors_.queue_size > 0 || (errors_.on_error && errors_.keeps_item())) {
+					std::exception_ptr error;
+					try {
+						cb_(item);
+						return;
+					} catch (...) {
+						error = std::current_exception();
+					}
+					if (!retry || !wait_backoff(attempt, st)) {
+						fail({error, std::move(item), attempt});
+						return;
+					}
+					continue;
+				}
+			}
+			try {
+				cb_(std::move(item));
+			} catch (...) {
+				fail({std::current_exception(), std::nullopt, attempt});
+			}
+			return;
+		}
+	}
+
+	// false if the queue is being destroyed, the item is not retried then
+	bool wait_backoff(size_t retry, std::stop_token st) {
+		auto d = errors_.backoff_before(retry);
+		if (d.count() > 0) {
+			std::mutex m;
+			std::unique_lock lock(m);
+			std::condition_variable_any cv;
+			cv.wait_for(lock, st, d, []() { return false; });
+		}
+		return !st.stop_requested();
+	}
+
+	void fail(task_error<type> e) {
+		failed_.fetch_add(1, std::memory_order_relaxed);
+		if (errors_.on_error) {
+			errors_.on_error(e);
+		}
+		if (errors_.queue_size > 0) {
+			std::unique_lock lock(errors_mutex_);
+			if (error_queue_.size() == errors_.queue_size)
+				error_queue_.pop_front();
+			error_queue_.push_back(std::move(e));
+		}
+	}
+
+	// locked: remove the front item, admitting the oldest suspended async_push if any
+	type take_locked(std::optional<detail::resumption>& wake, typename Stats::time_point& enqueued) {
+		type item = take_front_locked(enqueued);
+		if (can_admit_locked())
+			wake = admit_locked();
+		changed_locked();
+		return item;
+	}
+
+	// locked: move the item of the oldest suspended async_push into the queue
+	detail::resumption admit_locked() {
+		auto [h, a] = push_waiters_.front();
+		push_waiters_.pop_front();
+		if (!(index_ && conflate_locked(a->item))) {
+			append_locked(std::move(a->item));
+			stats_.on_push(q_.size());
+		}
+		return detail::resumption{h, a->resume};
+	}
+
+	// locked: give the front item to the oldest suspended async_pop
+	detail::resumption hand_over_locked() {
+		auto [h, a] = pop_waiters_.front();
+		pop_waiters_.pop_front();
+		typename Stats::time_point enqueued;
+		a->item.emplace(take_front_locked(enqueued));
+		consumed_locked(*a->item, enqueued);
+		return detail::resumption{h, a->resume};
+	}
+
+	// locked: an item was added to q_, hand it over to a suspended async_pop if any
+	std::optional<detail::resumption> pushed_locked() {
+		stats_.on_push(q_.size());
+		std::optional<detail::resumption> wake;
+		if (!pop_waiters_.empty() && q_.ready())
+			wake = hand_over_locked();
+		changed_locked();
+		return wake;
+	}
+
+	// locked: after slots were committed or freed out of the usual order, let every
+	// suspended coroutine proceed which now can
+	void settle_locked(std::vector<detail::resumption>& wakes) {
+		unspill_locked();
+		for (;;) {
+			if (!pop_waiters_.empty() && q_.ready()) {
+				wakes.push_back(hand_over_locked());
+			} else if (can_admit_locked()) {
+				wakes.push_back(admit_locked());
+			} else {
+				break;
+			}
+		}
+		changed_locked();
+	}
+
+	// locked: take the front item for a consumer other than the workers
+	type pop_locked(std::optional<detail::resumption>& wake) {
+		typename Stats::time_point enqueued;
+		type item = take_locked(wake, enqueued);
+		consumed_locked(item, enqueued);
+		if (bounded()) {
+			cv_.notify_all();
+		}
+		return item;
+	}
+
+	// locked: statistics of an item taken by a consumer other than the workers
+	void consumed_locked(const type& item, typename Stats::time_point enqueued) {
+		stats_.on_dequeue(consumer_id_, stats_.now(), enqueued, item);
+	}
+
+	// locked: q_ changed, refresh what is read without the lock
+	void changed_locked() {
+		gauges_.size.store(q_.size() + (spill_ ? spill_->size() : 0), std::memory_order_relaxed);
+		ready_.update(q_.ready());
+	}
+
+	static void resume(std::optional<detail::resumption>& wake) {
+		if (wake)
+			wake->resume(wake->handle);
+	}
+
+	bool suspend_push(std::coroutine_handle<> h, push_awaiter& a) {
+		std::optional<detail::resumption> wake;
+		{
+			std::unique_lock lock(mutex_);
+			if (index_ && conflate_locked(a.item))
+				return false;
+			auto w = weight_locked(a.item);
+			if (!spill_locked(a.item, w)) {
+				bool evicted = !has_room(w) && overflow_ != overflow::block;
+				if (evicted && !overflow_locked(a.item, w))
+					return false;
+				// room made by dropping older items is taken at once, as push() does; otherwise
+				// the suspended pushes go first
+				if (!(evicted && has_room(w)) && (!push_waiters_.empty() || !has_room(w))) {
+					push_waiters_.emplace_back(h, &a);
+					return true;
+				}
+				append_locked(std::move(a.item));
+			}
+			wake = pushed_locked();
+		}
+		cv_.notify_one();
+		resume(wake);
+		return false;
+	}
+
+	bool suspend_pop(std::coroutine_handle<> h, pop_awaiter& a) {
+		std::optional<detail::resumption> wake;
+		{
+			std::unique_lock lock(mutex_);
+			if (!q_.ready()) {
+				pop_waiters_.emplace_back(h, &a);
+				return true;
+			}
+			a.item.emplace(pop_locked(wake));
+		}
+		resume(wake);
+		return false;
+	}
+
+	// commit or give up a slot returned by reserve()
+	void finish_write(size_t index, bool commit) {
+		std::vector<detail::resumption> wakes;
+		{
+			std::unique_lock lock(mutex_);
+			if (commit) {
+				q_.commit(index);
+				bytes_ += weight_locked(q_.slot(index));
+				source_.notify();
+				stats_.on_push(q_.size());
+			} else {
+				q_.cancel(index);
+			}
+			settle_locked(wakes);
+		}
+		cv_.notify_all(); // several items may have become ready, or room freed
+		for (auto& w : wakes)
+			w.resume(w.handle);
+	}
+
+	// called locked with a ready front, returns unlocked
+	template<typename F>
+	void read_in_place(std::unique_lock<std::mutex>& lock, F& f) {
+		auto index = q_.acquire_front();
+		consumed_locked(q_.slot(index), stats_.on_pop());
+		if (index_)
+			index_->remove(q_.slot(index), pop_seq_);
+		++pop_seq_;
+		bytes_ -= weight_locked(q_.slot(index));
+		skip_cancelled_locked();
+		changed_locked();
+		lock.unlock();
+		struct releaser {
+			basic_task_queue* q;
+			size_t index;
+			~releaser() {
+				std::vector<detail::resumption> wakes;
+				{
+					std::unique_lock lock(q->mutex_);
+					q->q_.release(index);
+					q->settle_locked(wakes);
+				}
+				q->cv_.notify_all();
+				for (auto& w : wakes)
+					w.resume(w.handle);
+			}
+		} r{this, index};
+		f(q_.slot(index));
+	}
+
+	// locked: wait for room and append item, false if it was merged into a queued one instead
+	bool push_locked(std::unique_lock<std::mutex>& lock, type& item) {
+		if (index_ && conflate_locked(item))
+			return false;
+		auto w = weight_locked(item);
+		if (spill_locked(item, w))
+			return true;
+		if (!has_room(w) && overflow_ != overflow::block && !overflow_locked(item, w))
+			return false;
+		if (wait_for_room(lock, w) && index_ && conflate_locked(item))
+			return false; // the key was pushed while waiting
+		append_locked(std::move(item));
+		return true;
+	}
+
+	// locked, no room for weight w: apply a dropping overflow policy, false if item was dropped
+	bool overflow_locked(type& item, size_t w) {
+		if (overflow_ == overflow::drop_newest) {
+			drop_locked(item);
+			return false;
+		}
+		// several small items may have to go for a large one; a reserved front cannot be
+		// dropped, wait for room then
+		while (!has_room(w) && q_.ready()) {
+			typename Stats::time_point enqueued;
+			type oldest = take_front_locked(enqueued);
+			drop_locked(oldest);
+		}
+		return true;
+	}
+
+	// locked: the item numbered seq was taken by a worker, true if it is past its deadline
+	bool expire_locked(uint64_t seq, type& item) {
+		if (deadlines_.empty())
+			return false;
+		while (!deadlines_.empty() && deadlines_.front().first < seq)
+			deadlines_.pop_front();
+		if (deadlines_.empty() || deadlines_.front().first != seq)
+			return false;
+		auto deadline = deadlines_.front().second;
+		deadlines_.pop_front();
+		if (std::chrono::steady_clock::now() < deadline)
+			return false;
+		expired_.fetch_add(1, std::memory_order_relaxed);
+		if (on_expire_)
+			on_expire_(item);
+		return true;
+	}
+
+	void drop_locked(type& item) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		if (on_drop_)
+			on_drop_(item);
+	}
+
+	void append_locked(type&& item) {
+		if (index_)
+			index_->add(item, push_seq_);
+		++push_seq_;
+		bytes_ += weight_locked(item);
+		q_.push_back(std::move(item));
+		source_.notify();
+	}
+
+	// locked: write item to disk if the queue is full or items before it are there already,
+	// false if it belongs in memory
+	bool spill_locked(type& item, size_t w) {
+		if (!spill_ || (spill_->empty() && has_room(w)))
+			return false;
+		spill_buf_.clear();
+		codec_.encode(item, spill_buf_);
+		spill_->push(spill_buf_);
+		++push_seq_;
+		return true;
+	}
+
+	// locked: move spilled items back into the room left in memory, oldest first; an item
+	// is let in while the byte budget is not used up, it may overshoot by that one item
+	void unspill_locked() {
+		if (!spill_)
+			return;
+		while (!spill_->empty() && has_room()) {
+			type item = codec_.decode(spill_->front());
+			spill_->pop();
+			bytes_ += weight_locked(item);
+			q_.push_back(std::move(item));
+			source_.notify();
+		}
+	}
+
+	// locked: merge item into the queued item with the same key, if there is one
+	bool conflate_locked(type& item) {
+		if constexpr (detail::indexable<queue>) {
+			auto seq = index_->find(item);
+			if (!seq)
+				return false;
+			auto& queued = q_[*seq - pop_seq_];
+			bytes_ -= weight_locked(queued);
+			index_->merge(queued, std::move(item));
+			bytes_ += weight_locked(queued);
+			conflated_.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		} else {
+			return false; // set_conflation() is not available
+		}
+	}
+
+	// the enqueue stamp of the item is taken before the tombstones behind it are skipped,
+	// the statistics stamps are popped in queue order
+	type take_front_locked(typename Stats::time_point& enqueued) {
+		type item = remove_front_locked();
+		enqueued = stats_.on_pop();
+		skip_cancelled_locked();
+		return item;
+	}
+
+	type remove_front_locked() {
+		type item = detail::take_front(q_);
+		if (index_)
+			index_->remove(item, pop_seq_);
+		++pop_seq_;
+		bytes_ -= weight_locked(item);
+		unspill_locked();
+		return item;
+	}
+
+	// locked: discard the tombstones at the front, so that a ready front is never cancelled
+	void skip_cancelled_locked() {
+		while (!cancelled_.empty() && q_.ready() && cancelled_.erase(pop_seq_)) {
+			remove_front_locked();
+			stats_.on_pop(); // drops its stamp, no latency is recorded for it
+			skipped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	void reindex_locked() {
+		index_->clear();
+		if constexpr (detail::indexable<queue>) {
+			for (size_t i = 0; i < q_.size(); ++i) {
+				if (!cancelled_.contains(pop_seq_ + i))
+					index_->add(q_[i], pop_seq_ + i);
+			}
+		}
+	}
+
+	// weigh the queued items again; slots reserved and not committed are weighed by commit()
+	void recount_bytes_locked() {
+		bytes_ = 0;
+		if constexpr (detail::reservable<queue> || std::ranges::range<const queue>)
+			detail::for_each_committed(q_, [this](const type& item) { bytes_ += weight_(item); });
+	}
+
+	size_t weight_locked(const type& item) const {
+		return weight_ ? weight_(item) : 0;
+	}
+
+	// room for one more item of weight w; an item larger than the whole byte budget is
+	// accepted when nothing else is queued, it would wait forever otherwise
+	bool has_room(size_t w = 0) const {
+		return !q_.full() && (!max_bytes_ || bytes_ == 0 || bytes_ + w <= *max_bytes_);
+	}
+
+	bool bounded() const {
+		return q_.max_elements().has_value() || max_bytes_.has_value();
+	}
+
+	bool can_admit_locked() const {
+		return !push_waiters_.empty() && has_room(weight_locked(push_waiters_.front().second->item));
+	}
+
+	// block while a bounded queue has no room for weight w, true if it had to wait
+	bool wait_for_room(std::unique_lock<std::mutex>& lock, size_t w = 0) {
+		if (has_room(w))
+			return false;
+		auto since = stats_.now();
+		cv_.wait(lock, [this, w]() { return has_room(w); });
+		stats_.on_blocked(since);
+		return true;
+	}
+
+	// The members are grouped by who writes them, each group starting on a cache line of its
+	// own, so that a thread writing one group does not invalidate the lines another thread
+	// reads from a different group.
+
+	// read-mostly: set by the constructor and the set_*() methods, read on every item
 	callback cb_;
-	queue q_;
-	std::mutex mutex_;
+	error_policy<type> errors_;
+	overflow overflow_ = overflow::block;
+	std::function<void(type&)> on_drop_;
+	std::function<void(type&)> on_expire_;
+	std::optional<size_t> max_bytes_;
+	std::function<size_t(const type&)> weight_;
+	std::unique_ptr<detail::conflation_index<type>> index_; // conflation, see set_conflation()
+	spill_codec<type> codec_; // see set_spill()
+	size_t consumer_id_; // statistics slot of consumers which are not workers
+
+	// the lock and everything it protects, written by producers and consumers in turn
+	alignas(detail::cache_line_size) mutable std::mutex mutex_;
 	std::condition_variable_any cv_;
+	queue q_;
+	// every pushed item is numbered, the item numbered seq is at q_[seq - pop_seq_]
+	uint64_t push_seq_{};
+	uint64_t pop_seq_{};
+	size_t bytes_{}; // byte budget, see set_byte_budget()
+	// cancellation, see push_cancellable(): numbers of the tombstoned items
+	std::unordered_set<uint64_t> cancelled_;
+	bool numbered_ = false; // tickets or deadlines issued, they rely on the numbering
+	bool reserved_ = false; // reserve() used, its slots are not numbered
+	// deadlines, see push(item, deadline): (sequence number, deadline), in push order
+	std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> deadlines_;
+	// coroutines suspended in async_push() (queue full) and async_pop() (queue empty)
+	std::deque<std::pair<std::coroutine_handle<>, push_awaiter*>> push_waiters_;
+	std::deque<std::pair<std::coroutine_handle<>, pop_awaiter*>> pop_waiters_;
+	// spilled items, see set_spill(): they follow the items in q_ and are numbered after them
+	std::unique_ptr<detail::spill_file> spill_;
+	std::vector<std::byte> spill_buf_; // encoding buffer, reused
+	detail::ready_signal ready_; // closed after the workers are joined
+
+	// rarely written: the error queue and the counters of discarded items, read without the lock
+	alignas(detail::cache_line_size) std::mutex errors_mutex_;
+	std::deque<task_error<type>> error_queue_; // bounded by errors_.queue_size, oldest dropped
+	std::atomic<uint64_t> failed_{};
+	std::atomic<uint64_t> skipped_{};
+	std::atomic<uint64_t> expired_{};
+	std::atomic<uint64_t> conflated_{};
+	std::atomic<uint64_t> dropped_{};
+
+	// polled by other threads without the lock; every push and pop stores size under the lock,
+	// so pollers pull this line away from the data path, but not the lock's line
+	struct alignas(detail::cache_line_size) gauges_type {
+		std::atomic<size_t> size{}; // q_.size(), plus the spilled items
+		std::atomic<size_t> idle{}; // workers waiting for an item
+	} gauges_;
+	Stats stats_; // per-thread lines of its own when enabled, see queue_stats
+
+	// written by a fair_scheduler under its own lock; the threads are only started and joined
+	alignas(detail::cache_line_size) scheduled_source source_; // detached once no scheduler worker runs an item of this queue
 	std::vector<std::jthread> workers_;
 };
 
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 #include "ctq/circular_buffer.h"
 #include "ctq/task_queue.h"
+#include "ctq/arena_queue.h"
+#include "ctq/broadcast_queue.h"
+#include "ctq/sequenced_ring.h"
+#include "ctq/pipeline.h"
+#include "ctq/local_batcher.h"
 #include <vector>
 #include <list>
 #include <deque>
@@ -8,6 +13,20 @@
 #include <chrono>
 #include <atomic>
 #include <string>
+#include <memory>
+#include <stdexcept>
+#include <coroutine>
+#include <mutex>
+#include <fstream>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+#include <span>
+#if defined(__linux__)
+#include "ctq/durable_queue.h"
+#include <poll.h>
+#endif
 
 // ============================================================================
 // circular_buffer Tests
@@ -184,7 +203,7 @@ TEST(BasicTaskQueueTest, MaxElementsConstraint) {
 	{
 		// Create queue with max 2 elements
 		ctq::basic_task_queue<std::vector<int>> queue(
-			[&processed](int n) {
+			[&processed](int) {
 				processed++;
 				std::this_thread::sleep_for(std::chrono::milliseconds(50));
 			},
@@ -313,7 +332,7 @@ TEST(TaskQueueTest, SingleTypeWithMaxElements) {
 
 	{
 		ctq::task_queue<std::vector, int> queue(
-			[&counter](int n) {
+			[&counter](int) {
 				counter++;
 				std::this_thread::sleep_for(std::chrono::milliseconds(50));
 			},
@@ -414,7 +433,7 @@ TEST(TaskQueueTest, AccessQueueMethod) {
 	std::atomic<int> counter{0};
 
 	ctq::task_queue<std::vector, int> queue(
-		[&counter](int n) {
+		[&counter](int) {
 			counter++;
 			std::this_thread::sleep_for(std::chrono::milliseconds(50));
 		},
@@ -475,8 +494,8 @@ TEST(TaskQueueTest, MultiTypeWithMaxElements) {
 	{
 		ctq::task_queue<std::vector, int, std::string> queue(
 			{
-				[&int_counter](int n) { int_counter++; },
-				[&string_counter](std::string s) { string_counter++; }
+				[&int_counter](int) { int_counter++; },
+				[&string_counter](std::string) { string_counter++; }
 			},
 			3, // max 3 elements
 			1
@@ -499,9 +518,9 @@ TEST(TaskQueueTest, MultiTypeMultipleWorkers) {
 	{
 		ctq::task_queue<std::vector, int, std::string, double> queue(
 			{
-				[&total_processed](int n) { total_processed++; },
-				[&total_processed](std::string s) { total_processed++; },
-				[&total_processed](double d) { total_processed++; }
+				[&total_processed](int) { total_processed++; },
+				[&total_processed](std::string) { total_processed++; },
+				[&total_processed](double) { total_processed++; }
 			},
 			std::nullopt,
 			3 // 3 workers
@@ -574,7 +593,7 @@ TEST(TaskQueueTest, MultiTypeEmplaceInts) {
 		ctq::task_queue<std::vector, int, std::string> queue(
 			{
 				[&int_sum](int n) { int_sum += n; },
-				[&string_count](std::string s) { string_count++; }
+				[&string_count](std::string) { string_count++; }
 			},
 			std::nullopt,
 			1
@@ -600,7 +619,7 @@ TEST(TaskQueueTest, MultiTypeEmplaceStrings) {
 	{
 		ctq::task_queue<std::vector, int, std::string> queue(
 			{
-				[&int_count](int n) { int_count++; },
+				[&int_count](int) { int_count++; },
 				[&string_result, &string_mutex](std::string s) {
 					std::lock_guard<std::mutex> lock(string_mutex);
 					string_result += s;
@@ -754,8 +773,8 @@ TEST(ContainerTypeTest, TaskQueueWithList_MultiType) {
 	{
 		ctq::task_queue<std::list, int, std::string> queue(
 			{
-				[&int_count](int n) { int_count++; },
-				[&string_count](std::string s) { string_count++; }
+				[&int_count](int) { int_count++; },
+				[&string_count](std::string) { string_count++; }
 			},
 			std::nullopt,
 			2
@@ -779,7 +798,7 @@ TEST(ContainerTypeTest, TaskQueueWithList_BoundedQueue) {
 
 	{
 		ctq::task_queue<std::list, int> queue(
-			[&processed](int n) {
+			[&processed](int) {
 				processed++;
 				std::this_thread::sleep_for(std::chrono::milliseconds(50));
 			},
@@ -903,7 +922,7 @@ TEST(ContainerTypeTest, TaskQueueWithDeque_BoundedQueue) {
 
 	{
 		ctq::task_queue<std::deque, int> queue(
-			[&processed](int n) {
+			[&processed](int) {
 				processed++;
 				std::this_thread::sleep_for(std::chrono::milliseconds(30));
 			},
@@ -927,9 +946,9 @@ TEST(ContainerTypeTest, TaskQueueWithDeque_ThreeTypes) {
 	{
 		ctq::task_queue<std::deque, int, std::string, double> queue(
 			{
-				[&total](int n) { total++; },
-				[&total](std::string s) { total++; },
-				[&total](double d) { total++; }
+				[&total](int) { total++; },
+				[&total](std::string) { total++; },
+				[&total](double) { total++; }
 			},
 			std::nullopt,
 			3
@@ -1018,8 +1037,8 @@ TEST(ContainerTypeTest, AllContainersMultiType) {
 
 	auto callbacks = [](std::atomic<int>& counter) {
 		return std::make_tuple(
-			[&counter](int n) { counter++; },
-			[&counter](std::string s) { counter++; }
+			[&counter](int) { counter++; },
+			[&counter](std::string) { counter++; }
 		);
 	};
 
@@ -1103,7 +1122,7 @@ TEST(ContainerTypeTest, CircularBufferBoundedBehavior) {
 	{
 		// Circular buffer with capacity 5
 		ctq::basic_task_queue<ctq::circular_buffer<int>> queue(
-			[&processed](int n) {
+			[&processed](int) {
 				processed++;
 				std::this_thread::sleep_for(std::chrono::milliseconds(50));
 			},
@@ -1233,6 +1252,2381 @@ TEST(ContainerTypeTest, CircularBufferVsOtherContainers) {
 	EXPECT_EQ(list_sum.load(), 465);
 }
 
+// ============================================================================
+// histogram and queue_stats Tests
+// ============================================================================
+
+TEST(HistogramTest, SmallValuesAreExact) {
+	ctq::histogram h;
+	for (uint64_t v = 0; v < ctq::histogram::sub_bucket_count; ++v) {
+		EXPECT_EQ(ctq::histogram::bucket_index(v), v);
+		EXPECT_EQ(ctq::histogram::bucket_upper(v), v);
+	}
+
+	h.record(3);
+	h.record(5);
+	h.record(7);
+	EXPECT_EQ(h.count(), 3);
+	EXPECT_EQ(h.max(), 7);
+	EXPECT_DOUBLE_EQ(h.mean(), 5.0);
+	EXPECT_EQ(h.percentile(50), 5);
+	EXPECT_EQ(h.percentile(100), 7);
+}
+
+TEST(HistogramTest, RelativeErrorIsBounded) {
+	for (uint64_t v : {33ull, 100ull, 1000ull, 123456ull, 987654321ull}) {
+		auto i = ctq::histogram::bucket_index(v);
+		auto upper = ctq::histogram::bucket_upper(i);
+		EXPECT_GE(upper, v);
+		EXPECT_LE(upper - v, v / 16);
+		EXPECT_EQ(ctq::histogram::bucket_index(upper), i);
+	}
+	EXPECT_EQ(ctq::histogram::bucket_index(~0ull), ctq::histogram::bucket_count - 1);
+}
+
+TEST(HistogramTest, PercentilesAndMerge) {
+	ctq::histogram a;
+	ctq::histogram_recorder b;
+	for (uint64_t v = 1; v <= 500; ++v) {
+		a.record(v);
+		b.record(v + 500);
+	}
+	b.merge_into(a);
+
+	EXPECT_EQ(a.count(), 1000);
+	EXPECT_EQ(a.max(), 1000);
+	EXPECT_NEAR(static_cast<double>(a.percentile(50)), 500.0, 500.0 / 16);
+	EXPECT_NEAR(static_cast<double>(a.percentile(99)), 990.0, 990.0 / 16);
+	EXPECT_EQ(a.percentile(0), 1);
+}
+
+TEST(QueueStatsTest, CountsEnqueuedAndDequeued) {
+	ctq::basic_task_queue<std::vector<int>, ctq::queue_stats> queue(
+		[](int) { },
+		std::nullopt,
+		2
+	);
+
+	for (int i = 0; i < 100; ++i) {
+		queue.push(i);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	auto s = queue.stats();
+	EXPECT_EQ(s.enqueued, 100);
+	EXPECT_EQ(s.dequeued, 100);
+	EXPECT_EQ(s.depth, 0);
+	EXPECT_GE(s.high_water, 1);
+	EXPECT_EQ(s.latency.count(), 100);
+	ASSERT_EQ(s.workers.size(), 2);
+	EXPECT_EQ(s.workers[0].dequeued + s.workers[1].dequeued, 100);
+	EXPECT_EQ(s.blocked_pushes, 0);
+}
+
+TEST(QueueStatsTest, BlockedPushesAndHighWater) {
+	ctq::basic_task_queue<std::deque<int>, ctq::queue_stats> queue(
+		[](int) { std::this_thread::sleep_for(std::chrono::milliseconds(20)); },
+		2, // max 2 elements
+		1
+	);
+
+	for (int i = 0; i < 6; ++i) {
+		queue.push(i);
+	}
+
+	auto s = queue.stats();
+	EXPECT_EQ(s.enqueued, 6);
+	EXPECT_EQ(s.high_water, 2);
+	EXPECT_GT(s.blocked_pushes, 0);
+	EXPECT_GT(s.blocked_time.count(), 0);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	s = queue.stats();
+	EXPECT_EQ(s.dequeued, 6);
+	EXPECT_GE(s.busy_time, std::chrono::milliseconds(100));
+	EXPECT_GE(s.latency.max(), 20'000'000u);
+}
+
+TEST(QueueStatsTest, AccessQueueKeepsStampsInSync) {
+	std::atomic<bool> release{false};
+	std::atomic<int> processed{0};
+
+	ctq::basic_task_queue<std::list<int>, ctq::queue_stats> queue(
+		[&](int) {
+			while (!release) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			processed++;
+		},
+		std::nullopt,
+		1
+	);
+
+	for (int i = 0; i < 5; ++i) {
+		queue.push(i);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	queue.access_queue([](auto& q) { q.clear(); });
+	queue.push(10);
+	release = true;
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	auto s = queue.stats();
+	EXPECT_EQ(processed.load(), 2);
+	EXPECT_EQ(s.dequeued, 2);
+	EXPECT_EQ(s.latency.count(), 2);
+	EXPECT_EQ(s.depth, 0);
+}
+
+TEST(QueueStatsTest, SkippedTombstoneKeepsStampsInOrder) {
+	ctq::basic_task_queue<std::deque<int>, ctq::queue_stats> queue(std::nullopt);
+	queue.push(1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	auto t = queue.push_cancellable(2);
+	queue.push(3);
+	EXPECT_TRUE(queue.cancel(t)); // not at the front, skipped when 1 is taken
+
+	EXPECT_EQ(queue.pop(), 1);
+	EXPECT_EQ(queue.pop(), 3);
+	auto s = queue.stats();
+	EXPECT_EQ(s.latency.count(), 2);
+	EXPECT_GE(s.latency.max(), 30'000'000u); // the stamp of 1, not the one of the tombstone
+	EXPECT_EQ(s.depth, 0);
+}
+
+TEST(QueueStatsTest, PerTypeHistograms) {
+	std::atomic<int> processed{0};
+
+	{
+		ctq::task_queue<std::vector, ctq::instrumented<int, std::string>> queue(
+			{
+				[&processed](int) { processed++; },
+				[&processed](std::string) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+					processed++;
+				}
+			},
+			std::nullopt,
+			2
+		);
+
+		for (int i = 0; i < 10; ++i) {
+			queue.push(i);
+		}
+		queue.push(std::string("slow"));
+		queue.emplace("slower");
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		auto s = queue.stats();
+		EXPECT_EQ(s.enqueued, 12);
+		EXPECT_EQ(s.dequeued, 12);
+		EXPECT_EQ(s.of<int>().count(), 10);
+		EXPECT_EQ(s.of<std::string>().count(), 2);
+		EXPECT_EQ(s.of<std::string>().dwell_time.count(), 2);
+		EXPECT_GE(s.of<std::string>().exec_time.percentile(50), 5'000'000u);
+		EXPECT_LT(s.of<int>().exec_time.percentile(99), s.of<std::string>().exec_time.percentile(50));
+	}
+
+	EXPECT_EQ(processed.load(), 12);
+}
+
+// ============================================================================
+// error_policy Tests
+// ============================================================================
+
+TEST(ErrorPolicyTest, HandlerKeepsWorkerAlive) {
+	std::atomic<int> ok{0};
+	std::atomic<int> handled{0};
+	std::string last_error;
+	std::mutex error_mutex;
+
+	{
+		ctq::basic_task_queue<std::vector<int>> queue(
+			[&ok](int n) {
+				if (n % 2)
+					throw std::runtime_error("odd " + std::to_string(n));
+				ok++;
+			},
+			std::nullopt,
+			1,
+			ctq::error_policy<int>{}.handler([&](ctq::task_error<int>& e) {
+				handled++;
+				EXPECT_EQ(e.attempts, 1);
+				EXPECT_FALSE(e.item.has_value()); // not kept without retries or error queue
+				try {
+					std::rethrow_exception(e.error);
+				} catch (const std::exception& ex) {
+					std::lock_guard<std::mutex> lock(error_mutex);
+					last_error = ex.what();
+				}
+			})
+		);
+
+		for (int i = 0; i < 10; ++i) {
+			queue.push(i);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		EXPECT_EQ(queue.failed(), 5);
+	}
+
+	EXPECT_EQ(ok.load(), 5);
+	EXPECT_EQ(handled.load(), 5);
+	EXPECT_EQ(last_error, "odd 9");
+}
+
+TEST(ErrorPolicyTest, RetryWithBackoff) {
+	std::atomic<int> calls{0};
+	std::atomic<int> done{0};
+
+	{
+		ctq::task_queue<std::deque, int> queue(
+			[&](int n) {
+				// fail the first two attempts
+				if (++calls <= 2)
+					throw std::runtime_error("transient");
+				done += n;
+			},
+			std::nullopt,
+			1,
+			ctq::error_policy<int>{}.retry(3, std::chrono::milliseconds(5))
+		);
+
+		auto start = std::chrono::steady_clock::now();
+		queue.push(42);
+		while (done == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		// 5ms + 10ms of backoff
+		EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(15));
+		EXPECT_EQ(queue.failed(), 0);
+	}
+
+	EXPECT_EQ(calls.load(), 3);
+	EXPECT_EQ(done.load(), 42);
+}
+
+TEST(ErrorPolicyTest, BoundedErrorQueue) {
+	std::atomic<int> calls{0};
+
+	ctq::task_queue<std::vector, int, std::string> queue(
+		{
+			[&calls](int) { calls++; throw std::runtime_error("int"); },
+			[&calls](std::string s) { calls++; throw std::logic_error(s); }
+		},
+		std::nullopt,
+		1,
+		ctq::error_policy<std::variant<int, std::string>>{}.retry(1).queue(2)
+	);
+
+	queue.push(1);
+	queue.push(2);
+	queue.push(std::string("three"));
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	EXPECT_EQ(calls.load(), 6); // every item tried twice
+	EXPECT_EQ(queue.failed(), 3);
+
+	// the oldest failure was dropped
+	auto e = queue.pop_error();
+	ASSERT_TRUE(e.has_value());
+	EXPECT_EQ(e->attempts, 2);
+	ASSERT_TRUE(e->item.has_value());
+	EXPECT_EQ(std::get<int>(*e->item), 2);
+
+	e = queue.pop_error();
+	ASSERT_TRUE(e.has_value());
+	EXPECT_EQ(std::get<std::string>(*e->item), "three");
+	EXPECT_THROW(std::rethrow_exception(e->error), std::logic_error);
+
+	EXPECT_FALSE(queue.pop_error().has_value());
+}
+
+TEST(ErrorPolicyTest, LastAttemptMovesTheItem) {
+	// counts the copies made of it
+	struct item {
+		std::atomic<int>* copies;
+		item(std::atomic<int>* c) : copies(c) {}
+		item(const item& o) : copies(o.copies) { ++*copies; }
+		item(item&&) = default;
+		item& operator=(item&&) = default;
+	};
+	std::atomic<int> copies{0};
+	std::atomic<int> calls{0};
+	{
+		ctq::basic_task_queue<std::deque<item>> queue(
+			[&](item) {
+				if (++calls == 1)
+					throw std::runtime_error("transient");
+			},
+			std::nullopt,
+			1,
+			ctq::error_policy<item>{}.retry(1)
+		);
+		queue.push(item(&copies));
+		while (calls < 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_EQ(calls.load(), 2);
+	EXPECT_EQ(copies.load(), 1); // for the first attempt, which had a retry behind it
+}
+
+TEST(ErrorPolicyTest, RetryRequiresCopyableItems) {
+	using item = std::unique_ptr<int>;
+	auto make = []() {
+		return ctq::basic_task_queue<std::deque<item>>(
+			[](item) { },
+			std::nullopt,
+			1,
+			ctq::error_policy<item>{}.retry(1)
+		);
+	};
+	EXPECT_THROW(make(), std::invalid_argument);
+}
+
+// ============================================================================
+// future / submit Tests
+// ============================================================================
+
+TEST(FutureTest, SubmitReturnsResult) {
+	ctq::task_queue<std::deque, int(int)> queue(
+		[](int n) { return n * n; },
+		2
+	);
+
+	auto f1 = queue.submit(3);
+	auto f2 = queue.submit(4);
+	queue.push(5); // result discarded
+
+	EXPECT_EQ(f1.get(), 9);
+	EXPECT_EQ(f2.get(), 16);
+	EXPECT_FALSE(f1.valid());
+}
+
+TEST(FutureTest, SubmitPropagatesExceptions) {
+	ctq::task_queue<std::vector, std::string(int)> queue(
+		[](int n) -> std::string {
+			if (n < 0)
+				throw std::out_of_range("negative");
+			return std::to_string(n);
+		},
+		1
+	);
+
+	auto ok = queue.submit(7);
+	auto bad = queue.submit(-1);
+
+	EXPECT_EQ(ok.get(), "7");
+	EXPECT_THROW(bad.get(), std::out_of_range);
+}
+
+TEST(FutureTest, WhenAllCollectsInOrder) {
+	ctq::task_queue<std::deque, int(int)> queue(
+		[](int n) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(n % 3));
+			return n + 1;
+		},
+		4
+	);
+
+	std::vector<int> input(100);
+	for (int i = 0; i < 100; ++i) {
+		input[i] = i;
+	}
+
+	auto all = queue.submit_all(input.begin(), input.end());
+	auto results = all.get();
+
+	ASSERT_EQ(results.size(), 100);
+	for (int i = 0; i < 100; ++i) {
+		EXPECT_EQ(results[i], i + 1);
+	}
+}
+
+TEST(FutureTest, WhenAllVoidAndEmpty) {
+	std::atomic<int> sum{0};
+
+	ctq::task_queue<std::list, void(int)> queue(
+		[&sum](int n) { sum += n; },
+		2
+	);
+
+	std::vector<ctq::future<void>> futures;
+	for (int i = 1; i <= 10; ++i) {
+		futures.push_back(queue.submit(i));
+	}
+	ctq::when_all(std::move(futures)).get();
+	EXPECT_EQ(sum.load(), 55);
+
+	auto none = ctq::when_all(std::vector<ctq::future<int>>{});
+	EXPECT_TRUE(none.ready());
+	EXPECT_TRUE(none.get().empty());
+}
+
+TEST(FutureTest, BrokenPromiseOnDestruction) {
+	ctq::future<int> pending;
+	{
+		ctq::task_queue<std::deque, int(int)> queue(
+			[](int n) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				return n;
+			},
+			1
+		);
+		auto first = queue.submit(1);
+		auto second = queue.submit(2);
+		pending = queue.submit(3);
+		EXPECT_EQ(first.get(), 1);
+	} // the worker is busy with the second item, the third is still queued
+
+	try {
+		pending.get();
+		FAIL() << "expected broken_promise";
+	} catch (const std::future_error& e) {
+		EXPECT_EQ(e.code(), std::future_errc::broken_promise);
+	}
+}
+
+TEST(FutureTest, QueueMethodsTakeTheItemType) {
+	std::atomic<bool> go{false};
+	std::atomic<int> sum{0};
+	ctq::task_queue<std::deque, int(int)> queue(
+		[&](int n) {
+			go.wait(false);
+			sum += n;
+			return n;
+		},
+		3,
+		1
+	);
+	std::vector<int> dropped, expired;
+	queue.set_overflow(ctq::overflow::drop_newest, [&](int& n) { dropped.push_back(n); });
+	queue.set_expiry([&](int& n) { expired.push_back(n); });
+
+	queue.push(1); // taken by the worker, which waits for go
+	while (queue.size() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	auto t = queue.push_cancellable(2);
+	queue.push(4, std::chrono::steady_clock::now()); // past its deadline when taken
+	int eight = 8;
+	EXPECT_TRUE(queue.try_push(std::move(eight)));
+	int sixteen = 16;
+	EXPECT_FALSE(queue.try_push(std::move(sixteen)));
+	EXPECT_EQ(sixteen, 16);
+	queue.push(32); // dropped
+	EXPECT_EQ(queue.snapshot(), (std::vector<int>{2, 4, 8}));
+	EXPECT_TRUE(queue.cancel(t));
+
+	go = true;
+	go.notify_all();
+	while (sum < 9)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(sum, 9);
+	EXPECT_EQ(dropped, std::vector<int>{32});
+	EXPECT_EQ(expired, std::vector<int>{4});
+	EXPECT_EQ(queue.cancelled(), 1);
+}
+
+// ============================================================================
+// Coroutine Tests
+// ============================================================================
+
+namespace {
+
+// fire and forget coroutine, runs eagerly until its first suspension
+struct detached {
+	struct promise_type {
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// keeps the handles to resume, the test decides when
+struct manual_scheduler {
+	std::mutex mutex;
+	std::vector<std::coroutine_handle<>> ready;
+
+	void schedule(std::coroutine_handle<> h) {
+		std::lock_guard lock(mutex);
+		ready.push_back(h);
+	}
+
+	size_t pending() {
+		std::lock_guard lock(mutex);
+		return ready.size();
+	}
+
+	void run() {
+		std::vector<std::coroutine_handle<>> handles;
+		{
+			std::lock_guard lock(mutex);
+			handles.swap(ready);
+		}
+		for (auto h : handles)
+			h.resume();
+	}
+};
+
+} // namespace
+
+TEST(CoroutineTest, AsyncPopWithoutWorkers) {
+	ctq::basic_task_queue<std::deque<int>, ctq::queue_stats> queue([](int) { FAIL(); }, std::nullopt, 0);
+	std::vector<int> received;
+	std::atomic<bool> done{false};
+
+	auto consumer = [&]() -> detached {
+		for (int i = 0; i < 100; ++i)
+			received.push_back(co_await queue.async_pop());
+		done = true;
+	};
+	consumer(); // suspends on the empty queue
+
+	std::thread producer([&] {
+		for (int i = 0; i < 100; ++i)
+			queue.push(i);
+	});
+	producer.join();
+
+	ASSERT_TRUE(done);
+	for (int i = 0; i < 100; ++i)
+		EXPECT_EQ(received[i], i);
+	auto stats = queue.stats();
+	EXPECT_EQ(stats.enqueued, 100);
+	EXPECT_EQ(stats.dequeued, 100);
+	EXPECT_EQ(stats.depth, 0);
+	EXPECT_TRUE(stats.workers.empty());
+}
+
+TEST(CoroutineTest, AsyncPushSuspendsOnFullQueue) {
+	std::atomic<int> allowed{0};
+	std::atomic<int> processed{0};
+	ctq::basic_task_queue<std::deque<int>> queue(
+		[&](int) {
+			while (processed >= allowed)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			processed++;
+		},
+		2, 1
+	);
+	manual_scheduler sched;
+	int pushed = 0;
+
+	// the worker holds a first item, so the producer finds the queue as it leaves it
+	queue.push(-1);
+	while (queue.size() != 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	auto producer = [&]() -> detached {
+		for (int i = 0; i < 5; ++i) {
+			co_await queue.async_push(i, sched);
+			pushed++;
+		}
+	};
+	producer(); // returns as soon as it suspends, the thread is never blocked
+	EXPECT_EQ(pushed, 2);
+	EXPECT_EQ(sched.pending(), 0);
+
+	// the worker takes the next item, which admits the third: it is queued, but the
+	// coroutine waits for the scheduler
+	allowed = 1;
+	while (sched.pending() == 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(pushed, 2);
+	EXPECT_EQ(sched.pending(), 1);
+
+	allowed = 100;
+	while (pushed < 5) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		sched.run(); // resumed on this thread, not on the worker
+	}
+	while (processed < 6)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	EXPECT_EQ(processed, 6);
+}
+
+TEST(CoroutineTest, SchedulerResumesPop) {
+	ctq::task_queue<std::deque, std::string> queue([](std::string) { FAIL(); }, 0);
+	manual_scheduler sched;
+	std::string got;
+
+	auto consumer = [&]() -> detached {
+		got = co_await queue.async_pop(sched);
+	};
+	consumer();
+
+	queue.push("hello");
+	// handed over by push, but only resumed when the scheduler runs it
+	EXPECT_TRUE(got.empty());
+	ASSERT_EQ(sched.pending(), 1);
+	sched.run();
+	EXPECT_EQ(got, "hello");
+}
+
+TEST(CoroutineTest, AsyncPushDropOldestCompletesAtOnce) {
+	ctq::basic_task_queue<std::deque<int>> queue(2);
+	manual_scheduler sched;
+	std::vector<int> pushed;
+	auto producer = [&](int n) -> detached {
+		co_await queue.async_push(n, sched);
+		pushed.push_back(n);
+	};
+	producer(1);
+	producer(2);
+	producer(3); // suspended while the queue blocks
+	EXPECT_EQ(pushed, (std::vector<int>{1, 2}));
+
+	std::vector<int> dropped;
+	queue.set_overflow(ctq::overflow::drop_oldest, [&](int& n) { dropped.push_back(n); });
+	producer(4); // drops the oldest item and completes, not queued behind 3
+	EXPECT_EQ(pushed, (std::vector<int>{1, 2, 4}));
+	EXPECT_EQ(dropped, std::vector<int>{1});
+
+	EXPECT_EQ(queue.pop(), 2); // admits 3
+	ASSERT_EQ(sched.pending(), 1);
+	sched.run();
+	EXPECT_EQ(pushed, (std::vector<int>{1, 2, 4, 3}));
+	EXPECT_EQ(queue.pop(), 4);
+	EXPECT_EQ(queue.pop(), 3);
+}
+
+// ============================================================================
+// Pull Mode Tests
+// ============================================================================
+
+TEST(PullModeTest, TryPopAndPopBatch) {
+	ctq::basic_task_queue<std::deque<int>> queue(std::nullopt);
+	EXPECT_FALSE(queue.try_pop().has_value());
+
+	for (int i = 0; i < 10; ++i)
+		queue.push(i);
+	EXPECT_EQ(queue.try_pop(), 0);
+
+	std::vector<int> batch;
+	EXPECT_EQ(queue.pop_batch(std::back_inserter(batch), 4), 4);
+	EXPECT_EQ(batch, (std::vector<int>{1, 2, 3, 4}));
+	EXPECT_EQ(queue.pop_batch(std::back_inserter(batch), 100), 5);
+	EXPECT_EQ(batch.back(), 9);
+	EXPECT_EQ(queue.pop_batch(std::back_inserter(batch), 100), 0);
+}
+
+TEST(PullModeTest, PopWaitsForProducer) {
+	ctq::basic_task_queue<std::vector<std::string>> queue(std::nullopt);
+
+	std::thread producer([&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		queue.push("late");
+	});
+	EXPECT_EQ(queue.pop(), "late");
+	producer.join();
+}
+
+TEST(PullModeTest, PopForTimesOut) {
+	ctq::basic_task_queue<std::deque<int>> queue(std::nullopt);
+
+	auto start = std::chrono::steady_clock::now();
+	EXPECT_FALSE(queue.pop_for(std::chrono::milliseconds(30)).has_value());
+	EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(30));
+
+	queue.push(7);
+	EXPECT_EQ(queue.pop_for(std::chrono::milliseconds(30)), 7);
+}
+
+TEST(PullModeTest, PopUnblocksBoundedProducer) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>, ctq::queue_stats> queue(2);
+	std::atomic<int> pushed{0};
+
+	std::thread producer([&] {
+		for (int i = 0; i < 5; ++i) {
+			queue.push(i);
+			pushed++;
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	EXPECT_EQ(pushed, 2); // blocked on the full queue
+
+	for (int i = 0; i < 5; ++i)
+		EXPECT_EQ(queue.pop(), i);
+	producer.join();
+
+	auto stats = queue.stats();
+	EXPECT_EQ(stats.dequeued, 5);
+	EXPECT_GE(stats.blocked_pushes, 1);
+}
+
+#if defined(__linux__)
+namespace {
+
+bool readable(int fd) {
+	pollfd p{fd, POLLIN, 0};
+	return ::poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+// current counter of an eventfd, without consuming it
+uint64_t eventfd_count(int fd) {
+	std::ifstream info("/proc/self/fdinfo/" + std::to_string(fd));
+	std::string key;
+	while (info >> key) {
+		if (key == "eventfd-count:") {
+			std::string hex;
+			info >> hex;
+			return std::stoull(hex, nullptr, 16);
+		}
+	}
+	return ~uint64_t{0};
+}
+
+} // namespace
+
+TEST(PullModeTest, NativeHandleFollowsEmptiness) {
+	ctq::basic_task_queue<std::deque<int>> queue(std::nullopt);
+	queue.push(1);
+	int fd = queue.native_handle(); // created lazily, already reflects the queued item
+	ASSERT_GE(fd, 0);
+	EXPECT_TRUE(readable(fd));
+
+	EXPECT_EQ(queue.try_pop(), 1);
+	EXPECT_FALSE(readable(fd));
+
+	for (int i = 0; i < 100; ++i)
+		queue.push(i);
+	EXPECT_TRUE(readable(fd));
+	EXPECT_EQ(eventfd_count(fd), 1); // one write for the whole burst
+
+	std::vector<int> out;
+	queue.pop_batch(std::back_inserter(out), 99);
+	EXPECT_TRUE(readable(fd));
+	queue.pop();
+	EXPECT_FALSE(readable(fd));
+}
+#endif
+
+// ============================================================================
+// Reserve / Commit Tests
+// ============================================================================
+
+namespace {
+
+struct counted {
+	static inline std::atomic<int> copies{0};
+	static inline std::atomic<int> moves{0};
+
+	std::vector<char> payload;
+
+	counted() = default;
+	counted(const counted& o) : payload(o.payload) { copies++; }
+	counted(counted&& o) noexcept : payload(std::move(o.payload)) { moves++; }
+	counted& operator=(const counted& o) { payload = o.payload; copies++; return *this; }
+	counted& operator=(counted&& o) noexcept { payload = std::move(o.payload); moves++; return *this; }
+};
+
+} // namespace
+
+TEST(ReserveCommitTest, InPlaceWriteAndRead) {
+	ctq::basic_task_queue<ctq::circular_buffer<counted>> queue(4);
+	counted::copies = 0;
+	counted::moves = 0;
+
+	for (int round = 0; round < 3; ++round) {
+		for (char c = 'a'; c < 'd'; ++c) {
+			auto s = queue.reserve();
+			s->payload.assign(1000, c);
+			s.commit();
+		}
+		std::string seen;
+		while (queue.try_consume([&](counted& m) { seen += m.payload.front(); })) {}
+		EXPECT_EQ(seen, "abc");
+	}
+	EXPECT_EQ(counted::copies, 0);
+	EXPECT_EQ(counted::moves, 0);
+}
+
+TEST(ReserveCommitTest, ReservedFrontHoldsBackLaterItems) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue(4);
+
+	auto first = queue.reserve();
+	auto second = queue.reserve();
+	queue.push(3);
+	*second = 2;
+	second.commit();
+	EXPECT_FALSE(queue.try_pop().has_value()); // the first slot is not committed yet
+
+	*first = 1;
+	first.commit();
+	EXPECT_EQ(queue.try_pop(), 1);
+	EXPECT_EQ(queue.try_pop(), 2);
+	EXPECT_EQ(queue.try_pop(), 3);
+}
+
+TEST(ReserveCommitTest, AbandonedSlotIsSkipped) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue(2);
+	{
+		auto dropped = queue.reserve();
+		queue.push(1);
+	} // not committed
+
+	EXPECT_EQ(queue.try_pop(), 1);
+	EXPECT_FALSE(queue.try_pop().has_value());
+
+	// both slots are free again
+	queue.push(2);
+	queue.push(3);
+	EXPECT_EQ(queue.pop(), 2);
+	EXPECT_EQ(queue.pop(), 3);
+}
+
+TEST(ReserveCommitTest, SlotInUseIsNotReused) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue(2);
+	queue.push(1);
+	queue.push(2);
+
+	std::atomic<bool> reading{false};
+	std::atomic<bool> pushed{false};
+	std::thread consumer([&] {
+		queue.consume([&](int& v) {
+			reading = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			EXPECT_EQ(v, 1); // not overwritten by the producer meanwhile
+			EXPECT_FALSE(pushed);
+		});
+	});
+	while (!reading)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	queue.push(3); // blocks until the consumer releases its slot
+	pushed = true;
+	consumer.join();
+
+	EXPECT_EQ(queue.pop(), 2);
+	EXPECT_EQ(queue.pop(), 3);
+}
+
+TEST(ReserveCommitTest, WorkersTakeCommittedItems) {
+	std::atomic<int> sum{0};
+	{
+		ctq::basic_task_queue<ctq::circular_buffer<int>> queue([&](int v) { sum += v; }, 8, 2);
+		std::vector<std::thread> producers;
+		for (int p = 0; p < 4; ++p) {
+			producers.emplace_back([&] {
+				for (int i = 1; i <= 100; ++i) {
+					auto s = queue.reserve();
+					*s = i;
+					s.commit();
+				}
+			});
+		}
+		for (auto& t : producers)
+			t.join();
+		while (sum < 4 * 5050)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_EQ(sum, 4 * 5050);
+}
+
+// ============================================================================
+// arena_queue Tests
+// ============================================================================
+
+namespace {
+
+struct big_message {
+	std::array<char, 256> data{};
+	int id{};
+};
+
+} // namespace
+
+TEST(ArenaQueueTest, MixedTypesInOrder) {
+	ctq::arena_queue<std::variant<int, std::string, big_message>> q(64);
+	q.push_back(1);
+	q.emplace_back(std::string("hello"));
+	q.emplace_back(big_message{{}, 7});
+	q.emplace_back(std::string(100, 'x')); // longer than the small string buffer
+	EXPECT_EQ(q.size(), 4);
+
+	EXPECT_EQ(std::get<int>(q.front()), 1);
+	EXPECT_EQ(std::get<int>(q.next()), 1);
+	EXPECT_EQ(std::get<std::string>(q.next()), "hello");
+	EXPECT_EQ(std::get<big_message>(q.next()).id, 7);
+	EXPECT_EQ(std::get<std::string>(q.next()), std::string(100, 'x'));
+	EXPECT_TRUE(q.empty());
+	EXPECT_EQ(q.bytes_used(), 0);
+}
+
+TEST(ArenaQueueTest, ExactSizeRecords) {
+	using item = std::variant<int, std::string, big_message>;
+	ctq::arena_queue<item> q(1 << 16);
+	for (int i = 0; i < 100; ++i)
+		q.push_back(i);
+	// 8 byte header + 4 byte int, padded to 8: far less than sizeof(item) per item
+	EXPECT_EQ(q.bytes_used(), 100 * 16);
+	EXPECT_LT(q.bytes_used(), 100 * sizeof(item));
+}
+
+TEST(ArenaQueueTest, WrapsAndGrows) {
+	ctq::arena_queue<std::variant<int, std::string>> q(128);
+	int next_in = 0;
+	int next_out = 0;
+	// keep a few items queued while the ring wraps many times
+	for (int round = 0; round < 200; ++round) {
+		for (int k = 0; k < 3; ++k) {
+			if ((next_in % 2) == 0)
+				q.push_back(next_in);
+			else
+				q.push_back(std::to_string(next_in));
+			++next_in;
+		}
+		for (int k = 0; k < 2; ++k) {
+			auto v = q.next();
+			if ((next_out % 2) == 0)
+				EXPECT_EQ(std::get<int>(v), next_out);
+			else
+				EXPECT_EQ(std::get<std::string>(v), std::to_string(next_out));
+			++next_out;
+		}
+	}
+	EXPECT_GT(q.capacity_bytes(), 128); // 200 items left over do not fit the initial ring
+	while (!q.empty()) {
+		auto v = q.next();
+		if ((next_out % 2) == 0) {
+			EXPECT_EQ(std::get<int>(v), next_out);
+		}
+		++next_out;
+	}
+	EXPECT_EQ(next_out, next_in);
+}
+
+TEST(ArenaQueueTest, RelocatesNonTrivialTypes) {
+	auto tracker = std::make_shared<int>(0);
+	{
+		ctq::arena_queue<std::variant<std::shared_ptr<int>, int>> q(32);
+		for (int i = 0; i < 50; ++i)
+			q.push_back(tracker);
+		EXPECT_EQ(tracker.use_count(), 51);
+		for (int i = 0; i < 20; ++i)
+			q.pop_front();
+		EXPECT_EQ(tracker.use_count(), 31);
+	} // the destructor destroys what is left
+	EXPECT_EQ(tracker.use_count(), 1);
+}
+
+TEST(ArenaQueueTest, AsTaskQueueContainer) {
+	std::atomic<int> ints{0};
+	std::atomic<size_t> chars{0};
+	{
+		ctq::task_queue<ctq::arena_queue, int, std::string> queue(
+			{
+				[&](int v) { ints += v; },
+				[&](std::string s) { chars += s.size(); }
+			},
+			2
+		);
+		for (int i = 0; i < 100; ++i) {
+			queue.push(1);
+			queue.push(std::string(i, 'a'));
+		}
+		while (ints < 100 || chars < 4950)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_EQ(ints, 100);
+	EXPECT_EQ(chars, 4950);
+}
+
+// ============================================================================
+// Conflation Tests
+// ============================================================================
+
+namespace {
+
+struct tick {
+	std::string symbol;
+	double price{};
+	int updates{1};
+};
+
+} // namespace
+
+TEST(ConflationTest, LatestItemPerKey) {
+	ctq::basic_task_queue<std::deque<tick>> queue(std::nullopt);
+	queue.set_conflation([](const tick& t) { return t.symbol; });
+
+	queue.push({"AAA", 1.0});
+	queue.push({"BBB", 2.0});
+	queue.push({"AAA", 1.5});
+	queue.emplace(tick{"AAA", 1.7});
+
+	EXPECT_EQ(queue.conflated(), 2);
+	auto first = queue.try_pop();
+	ASSERT_TRUE(first.has_value());
+	EXPECT_EQ(first->symbol, "AAA"); // keeps the position of the first push
+	EXPECT_EQ(first->price, 1.7);
+	EXPECT_EQ(queue.try_pop()->symbol, "BBB");
+	EXPECT_FALSE(queue.try_pop().has_value());
+
+	// the key left the queue, the next push appends again
+	queue.push({"AAA", 1.8});
+	EXPECT_EQ(queue.try_pop()->price, 1.8);
+}
+
+TEST(ConflationTest, CustomMerge) {
+	ctq::basic_task_queue<std::vector<tick>> queue(std::nullopt);
+	queue.set_conflation(
+		[](const tick& t) { return t.symbol; },
+		[](tick& queued, tick&& incoming) {
+			queued.price = incoming.price;
+			queued.updates += incoming.updates;
+		}
+	);
+	for (int i = 0; i < 10; ++i)
+		queue.push({i % 2 ? "AAA" : "BBB", double(i)});
+
+	std::vector<tick> out;
+	EXPECT_EQ(queue.pop_batch(std::back_inserter(out), 10), 2);
+	EXPECT_EQ(out[0].symbol, "BBB");
+	EXPECT_EQ(out[0].updates, 5);
+	EXPECT_EQ(out[0].price, 8.0);
+	EXPECT_EQ(out[1].updates, 5);
+	EXPECT_EQ(out[1].price, 9.0);
+}
+
+TEST(ConflationTest, FullQueueDoesNotBlockKnownKeys) {
+	ctq::basic_task_queue<ctq::circular_buffer<tick>> queue(2);
+	queue.set_conflation([](const tick& t) { return t.symbol; });
+	queue.push({"AAA", 1.0});
+	queue.push({"BBB", 1.0});
+
+	// the queue is full, but these only update queued items
+	for (int i = 0; i < 100; ++i)
+		queue.push({i % 2 ? "AAA" : "BBB", double(i)});
+	EXPECT_EQ(queue.conflated(), 100);
+	EXPECT_EQ(queue.pop().price, 99.0);
+	EXPECT_EQ(queue.pop().price, 98.0);
+}
+
+TEST(ConflationTest, DepthBoundedByKeys) {
+	std::atomic<bool> release{false};
+	std::atomic<int> processed{0};
+	ctq::basic_task_queue<std::deque<int>, ctq::queue_stats> queue(
+		[&](int) {
+			while (!release)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			processed++;
+		},
+		std::nullopt, 1
+	);
+	queue.set_conflation([](int v) { return v % 8; });
+
+	for (int i = 0; i < 1000; ++i)
+		queue.push(i);
+	EXPECT_LE(queue.stats().high_water, 8);
+	release = true;
+	while (processed + queue.conflated() < 1000)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_LE(processed, 9);
+}
+
+TEST(ConflationTest, AccessQueueReindexes) {
+	ctq::basic_task_queue<std::deque<tick>> queue(std::nullopt);
+	queue.push({"AAA", 1.0});
+	queue.push({"BBB", 1.0});
+	queue.set_conflation([](const tick& t) { return t.symbol; }); // indexes the queued items
+
+	queue.access_queue([](auto& q) { q.pop_front(); });
+	queue.push({"BBB", 2.0});
+	queue.push({"AAA", 3.0});
+
+	EXPECT_EQ(queue.pop().price, 2.0);
+	EXPECT_EQ(queue.pop().price, 3.0);
+	EXPECT_FALSE(queue.try_pop().has_value());
+}
+
+TEST(ConflationTest, RejectedAfterReserve) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue(4);
+	auto s = queue.reserve(); // not committed: the index would miss its slot
+	*s = 1;
+	EXPECT_THROW(queue.set_conflation([](int n) { return n; }), std::logic_error);
+	s.commit();
+	EXPECT_EQ(queue.pop(), 1);
+	EXPECT_THROW(queue.set_conflation([](int n) { return n; }), std::logic_error);
+}
+
+// ============================================================================
+// Overflow Policy Tests
+// ============================================================================
+
+TEST(OverflowTest, TryPushRejectsWhenFull) {
+	ctq::basic_task_queue<std::deque<int>> queue(2);
+	int a = 1, b = 2;
+	std::string kept = "kept";
+	EXPECT_TRUE(queue.try_push(std::move(a)));
+	EXPECT_TRUE(queue.try_push(std::move(b)));
+	EXPECT_FALSE(queue.try_push(3));
+	EXPECT_EQ(queue.dropped(), 0);
+
+	ctq::basic_task_queue<std::vector<std::string>> strings(0);
+	EXPECT_FALSE(strings.try_push(std::move(kept)));
+	EXPECT_EQ(kept, "kept"); // not moved from when rejected
+}
+
+TEST(OverflowTest, DropNewest) {
+	ctq::basic_task_queue<std::deque<int>> queue(3);
+	std::vector<int> dropped;
+	queue.set_overflow(ctq::overflow::drop_newest, [&](int& v) { dropped.push_back(v); });
+
+	for (int i = 0; i < 10; ++i)
+		queue.push(i); // never blocks
+	EXPECT_EQ(queue.dropped(), 7);
+	EXPECT_EQ(dropped, (std::vector<int>{3, 4, 5, 6, 7, 8, 9}));
+	EXPECT_EQ(queue.pop(), 0);
+	EXPECT_EQ(queue.pop(), 1);
+	EXPECT_EQ(queue.pop(), 2);
+}
+
+TEST(OverflowTest, DropOldestOverwritesRing) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>, ctq::queue_stats> queue(3);
+	std::vector<int> dropped;
+	queue.set_overflow(ctq::overflow::drop_oldest, [&](int& v) { dropped.push_back(v); });
+
+	for (int i = 0; i < 10; ++i)
+		queue.emplace(i);
+	EXPECT_EQ(queue.dropped(), 7);
+	EXPECT_EQ(dropped, (std::vector<int>{0, 1, 2, 3, 4, 5, 6}));
+	EXPECT_EQ(queue.pop(), 7);
+	EXPECT_EQ(queue.pop(), 8);
+	EXPECT_EQ(queue.pop(), 9);
+	EXPECT_EQ(queue.stats().depth, 0);
+}
+
+TEST(OverflowTest, TaskQueueShedsLoad) {
+	std::atomic<bool> release{false};
+	std::atomic<int> processed{0};
+	{
+		ctq::task_queue<std::deque, int, std::string> queue(
+			{
+				[&](int) {
+					while (!release)
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					processed++;
+				},
+				[&](std::string) { processed++; }
+			},
+			4, 1
+		);
+		queue.set_overflow(ctq::overflow::drop_oldest);
+		for (int i = 0; i < 100; ++i)
+			queue.push(i);
+		EXPECT_GE(queue.dropped(), 95); // the worker holds at most one, four are queued
+		release = true;
+		while (processed + queue.dropped() < 100)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_LE(processed, 5);
+}
+
+// ============================================================================
+// Byte Budget Tests
+// ============================================================================
+
+namespace {
+
+size_t string_weight(const std::string& s) {
+	return s.size();
+}
+
+} // namespace
+
+TEST(ByteBudgetTest, BlocksUntilBytesAreFreed) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(std::nullopt);
+	queue.set_byte_budget(100, string_weight);
+
+	queue.push(std::string(60, 'a'));
+	queue.push(std::string(30, 'b'));
+	EXPECT_EQ(queue.queued_bytes(), 90);
+
+	std::atomic<bool> pushed{false};
+	std::thread producer([&] {
+		queue.push(std::string(20, 'c')); // 110 bytes would exceed the budget
+		pushed = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	EXPECT_FALSE(pushed);
+
+	EXPECT_EQ(queue.pop().size(), 60);
+	producer.join();
+	EXPECT_TRUE(pushed);
+	EXPECT_EQ(queue.queued_bytes(), 50);
+}
+
+TEST(ByteBudgetTest, TryPushAndOversizedItem) {
+	ctq::basic_task_queue<std::vector<std::string>> queue(std::nullopt);
+	queue.set_byte_budget(100, string_weight);
+
+	std::string big(500, 'x');
+	EXPECT_TRUE(queue.try_push(std::move(big))); // alone in the queue, accepted
+	std::string small(1, 'y');
+	EXPECT_FALSE(queue.try_push(std::move(small)));
+	EXPECT_EQ(small, "y");
+
+	queue.pop();
+	EXPECT_EQ(queue.queued_bytes(), 0);
+	for (int i = 0; i < 10; ++i)
+		EXPECT_TRUE(queue.try_push(std::string(10, 'z')));
+	EXPECT_FALSE(queue.try_push(std::string(1, 'z')));
+}
+
+TEST(ByteBudgetTest, DropOldestFreesEnoughBytes) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(std::nullopt);
+	queue.set_byte_budget(100, string_weight);
+	queue.set_overflow(ctq::overflow::drop_oldest);
+
+	for (int i = 0; i < 10; ++i)
+		queue.push(std::string(10, 'a' + i));
+	queue.push(std::string(35, 'z')); // evicts the four oldest items
+
+	EXPECT_EQ(queue.dropped(), 4);
+	EXPECT_EQ(queue.queued_bytes(), 95);
+	EXPECT_EQ(queue.pop().front(), 'e');
+}
+
+TEST(ByteBudgetTest, WorkersWithMixedPayloads) {
+	std::atomic<size_t> max_seen{0};
+	std::atomic<size_t> total{0};
+	{
+		ctq::task_queue<std::list, std::string> queue([&](std::string s) { total += s.size(); }, std::nullopt, 2);
+		queue.set_byte_budget(1 << 16, string_weight);
+		std::thread observer([&] {
+			while (total < 200 * 1000) {
+				max_seen = std::max<size_t>(max_seen, queue.queued_bytes());
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+		for (int i = 0; i < 200; ++i)
+			queue.push(std::string(i % 2 ? 10 : 1990, 's'));
+		observer.join();
+	}
+	EXPECT_EQ(total, 200 * 1000);
+	EXPECT_LE(max_seen, 1 << 16);
+}
+
+TEST(ByteBudgetTest, ReservedSlotIsWeighedOnCommit) {
+	ctq::basic_task_queue<ctq::circular_buffer<std::string>> queue(4);
+	queue.push("ab");
+	auto s = queue.reserve();
+	*s = "abcd";
+	queue.set_byte_budget(100, string_weight); // weighs the committed item only
+	EXPECT_EQ(queue.queued_bytes(), 2);
+	s.commit();
+	EXPECT_EQ(queue.queued_bytes(), 6);
+	queue.pop();
+	queue.pop();
+	EXPECT_EQ(queue.queued_bytes(), 0);
+}
+
+// ============================================================================
+// Fair Scheduler Tests
+// ============================================================================
+
+TEST(FairSchedulerTest, WeightedShares) {
+	ctq::fair_scheduler pool(1);
+	std::mutex mutex;
+	std::string order;
+	std::atomic<bool> release{false};
+	auto record = [&](char c) {
+		std::lock_guard lock(mutex);
+		order += c;
+	};
+
+	// keeps the only worker busy until both queues are filled
+	ctq::basic_task_queue<std::deque<int>> gate([&](int) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}, std::nullopt, pool);
+	ctq::basic_task_queue<std::deque<int>> gold([&](int) { record('G'); }, std::nullopt, pool, 3);
+	ctq::basic_task_queue<std::deque<int>, ctq::queue_stats> bronze([&](int) { record('B'); }, std::nullopt, pool, 1);
+
+	gate.push(0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (int i = 0; i < 400; ++i) {
+		gold.push(i);
+		bronze.push(i);
+	}
+	release = true;
+	while (bronze.stats().dequeued < 400)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::lock_guard lock(mutex);
+	ASSERT_EQ(order.size(), 800);
+	// while both are busy gold gets three turns for every one of bronze
+	auto gold_first = std::count(order.begin(), order.begin() + 400, 'G');
+	EXPECT_EQ(gold_first, 300);
+	EXPECT_EQ(order.substr(0, 8), "GGGBGGGB");
+}
+
+TEST(FairSchedulerTest, FloodedQueueDoesNotStarveOthers) {
+	ctq::fair_scheduler pool(2);
+	std::atomic<int> slow_done{0};
+	std::atomic<int> fast_done{0};
+	ctq::basic_task_queue<std::deque<int>> flood([&](int) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		slow_done++;
+	}, std::nullopt, pool);
+	ctq::basic_task_queue<std::deque<int>> interactive([&](int) { fast_done++; }, std::nullopt, pool);
+
+	for (int i = 0; i < 1000; ++i)
+		flood.push(i);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (int i = 0; i < 10; ++i)
+		interactive.push(i);
+
+	auto start = std::chrono::steady_clock::now();
+	while (fast_done < 10 && std::chrono::steady_clock::now() - start < std::chrono::seconds(2))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(fast_done, 10);
+	EXPECT_LT(slow_done, 500); // served long before the flood is drained
+}
+
+TEST(FairSchedulerTest, QueueDestroyedWhileRunning) {
+	ctq::fair_scheduler pool(2);
+	std::atomic<int> started{0};
+	std::atomic<int> finished{0};
+	{
+		ctq::basic_task_queue<std::deque<int>> queue([&](int) {
+			started++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(30));
+			finished++;
+		}, std::nullopt, pool);
+		queue.push(1);
+		queue.push(2);
+		queue.push(3);
+		while (started < 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	} // waits for the two running items, the third is discarded
+	EXPECT_EQ(finished, started);
+
+	// the pool keeps serving other queues
+	std::atomic<int> done{0};
+	ctq::basic_task_queue<std::deque<int>> other([&](int) { done++; }, std::nullopt, pool);
+	other.push(1);
+	while (done < 1)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(done, 1);
+}
+
+// ============================================================================
+// Broadcast Queue Tests
+// ============================================================================
+
+TEST(BroadcastQueueTest, EverySubscriberSeesEveryItem) {
+	std::mutex mutex;
+	std::vector<int> a, b;
+	{
+		ctq::broadcast_queue<int> topic(8);
+		topic.subscribe([&](const int& v) { std::lock_guard lock(mutex); a.push_back(v); });
+		topic.subscribe([&](const int& v) { std::lock_guard lock(mutex); b.push_back(v); });
+		EXPECT_EQ(topic.subscribers(), 2);
+		for (int i = 0; i < 100; ++i)
+			topic.push(i);
+		while (topic.size() > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::vector<int> expected(100);
+	std::iota(expected.begin(), expected.end(), 0);
+	EXPECT_EQ(a, expected);
+	EXPECT_EQ(b, expected);
+}
+
+TEST(BroadcastQueueTest, ItemsAreNotCopied) {
+	std::atomic<int> seen{0};
+	std::mutex mutex;
+	std::vector<const std::string*> addresses;
+	ctq::broadcast_queue<std::string> topic(4);
+	for (int i = 0; i < 3; ++i) {
+		topic.subscribe([&](const std::string& s) {
+			std::lock_guard lock(mutex);
+			addresses.push_back(&s);
+			seen++;
+		});
+	}
+	topic.push(std::string(100, 'x'));
+	while (seen < 3)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	// all three read the same slot
+	EXPECT_EQ(addresses[0], addresses[1]);
+	EXPECT_EQ(addresses[1], addresses[2]);
+}
+
+TEST(BroadcastQueueTest, SlowestSubscriberBlocksProducer) {
+	std::atomic<bool> release{false};
+	std::atomic<int> fast{0};
+	std::atomic<int> pushed{0};
+	ctq::broadcast_queue<int> topic(4);
+	topic.subscribe([&](const int&) { fast++; });
+	topic.subscribe([&](const int&) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	});
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 10; ++i) {
+			topic.push(i);
+			pushed++;
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	// the slow subscriber holds the first item: the ring fills up behind it
+	EXPECT_LE(pushed, 5);
+	EXPECT_LE(fast, 5);
+	release = true;
+	producer.join();
+	while (topic.size() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(fast, 10);
+}
+
+TEST(BroadcastQueueTest, UnsubscribeReleasesSlots) {
+	std::atomic<bool> release{false};
+	std::atomic<int> fast{0};
+	ctq::broadcast_queue<int> topic(2);
+	topic.subscribe([&](const int&) { fast++; });
+	auto slow = topic.subscribe([&](const int&) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	});
+	topic.push(1);
+	topic.push(2);
+	EXPECT_GT(topic.size(), 0);
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 10; ++i)
+			topic.push(i);
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	release = true;
+	topic.unsubscribe(slow); // finishes the item it is on, then stops holding the ring back
+	producer.join();
+	EXPECT_EQ(topic.subscribers(), 1);
+	while (topic.size() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(fast, 12);
+}
+
+TEST(BroadcastQueueTest, LateSubscriberSeesOnlyNewItems) {
+	ctq::broadcast_queue<int> topic(4);
+	topic.push(1); // no subscribers: discarded
+	EXPECT_EQ(topic.size(), 0);
+	std::atomic<int> sum{0};
+	topic.subscribe([&](const int& v) { sum += v; });
+	topic.push(10);
+	topic.push(20);
+	while (topic.size() > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(sum, 30);
+}
+
+// ============================================================================
+// Sequenced Ring Tests
+// ============================================================================
+
+namespace {
+
+struct pipeline_item {
+	int value = 0;
+	int parsed = 0;
+	int left = 0;
+	int right = 0;
+};
+
+} // namespace
+
+TEST(SequencedRingTest, StagesRunInOrderOnTheSameSlot) {
+	std::vector<int> out;
+	{
+		ctq::sequenced_ring<pipeline_item> ring(4);
+		auto parse = ring.add_stage([](pipeline_item& i) { i.parsed = i.value * 2; });
+		ring.add_stage([&](pipeline_item& i) { out.push_back(i.parsed + 1); }, {parse});
+		EXPECT_EQ(ring.stages(), 2);
+		for (int i = 0; i < 100; ++i)
+			ring.push(pipeline_item{i});
+		EXPECT_EQ(ring.published(), 100);
+	} // the stages drain the ring
+	ASSERT_EQ(out.size(), 100);
+	for (int i = 0; i < 100; ++i)
+		EXPECT_EQ(out[i], i * 2 + 1);
+}
+
+TEST(SequencedRingTest, DiamondDependencies) {
+	std::atomic<int> errors{0};
+	std::atomic<int> joined{0};
+	{
+		ctq::sequenced_ring<pipeline_item> ring(8);
+		auto parse = ring.add_stage([](pipeline_item& i) { i.parsed = i.value; });
+		// the two middle stages run concurrently, each on its own field
+		auto left = ring.add_stage([](pipeline_item& i) { i.left = i.parsed + 1; }, {parse});
+		auto right = ring.add_stage([](pipeline_item& i) { i.right = i.parsed + 2; }, {parse});
+		ring.add_stage([&](pipeline_item& i) {
+			if (i.left != i.value + 1 || i.right != i.value + 2)
+				errors++;
+			joined++;
+		}, {left, right});
+		for (int i = 0; i < 1000; ++i)
+			ring.emplace(pipeline_item{i});
+	}
+	EXPECT_EQ(joined, 1000);
+	EXPECT_EQ(errors, 0);
+}
+
+TEST(SequencedRingTest, ProducerWaitsForTheLastStage) {
+	std::atomic<bool> release{false};
+	ctq::sequenced_ring<int> ring(4);
+	auto first = ring.add_stage([](int&) {});
+	auto last = ring.add_stage([&](int&) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}, {first});
+
+	std::atomic<int> pushed{0};
+	std::thread producer([&]() {
+		for (int i = 0; i < 10; ++i) {
+			ring.push(i);
+			pushed++;
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	EXPECT_EQ(pushed, 4); // the ring is full behind the last stage
+	EXPECT_EQ(ring.processed(first), 4);
+	EXPECT_EQ(ring.processed(last), 0);
+	release = true;
+	producer.join();
+	while (ring.processed(last) < 10)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(ring.processed(first), 10);
+}
+
+TEST(SequencedRingTest, MultipleProducers) {
+	std::atomic<long> sum{0};
+	{
+		ctq::sequenced_ring<int> ring(16);
+		ring.add_stage([&](int& v) { sum += v; });
+		std::vector<std::thread> producers;
+		for (int p = 0; p < 4; ++p) {
+			producers.emplace_back([&]() {
+				for (int i = 1; i <= 1000; ++i)
+					ring.push(i);
+			});
+		}
+		for (auto& t : producers)
+			t.join();
+	}
+	EXPECT_EQ(sum, 4 * 500500);
+}
+
+// ============================================================================
+// Pipeline Tests
+// ============================================================================
+
+TEST(PipelineTest, StagesChangeTheItemType) {
+	std::mutex mutex;
+	std::vector<std::string> out;
+	ctq::pipeline p(
+		ctq::stage([](int n) { return n * 2; }),
+		ctq::stage([](int n) { return static_cast<double>(n) + 0.5; }),
+		ctq::stage([&](double d) {
+			std::lock_guard lock(mutex);
+			out.push_back(std::to_string(static_cast<int>(d * 2)));
+		}));
+	static_assert(std::is_same_v<decltype(p)::type, int>);
+	for (int i = 0; i < 50; ++i)
+		p.push(i);
+	p.drain();
+	EXPECT_EQ(p.in_flight(), 0);
+	ASSERT_EQ(out.size(), 50);
+	for (int i = 0; i < 50; ++i)
+		EXPECT_EQ(out[i], std::to_string(i * 4 + 1));
+}
+
+TEST(PipelineTest, ParallelStage) {
+	std::atomic<int> sum{0};
+	ctq::pipeline p(
+		ctq::stage([](std::string s) { return s.size(); }),
+		ctq::stage([](size_t n) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			return static_cast<int>(n);
+		}, 4, 16),
+		ctq::stage([&](int n) { sum += n; }));
+	for (int i = 0; i < 100; ++i)
+		p.emplace(3, 'x');
+	p.drain();
+	EXPECT_EQ(sum, 300);
+}
+
+TEST(PipelineTest, BackpressureReachesTheProducer) {
+	std::atomic<bool> release{false};
+	std::atomic<int> done{0};
+	std::atomic<int> pushed{0};
+	ctq::pipeline p(
+		ctq::stage([](int n) { return n; }, 1, 2),
+		ctq::stage([&](int) {
+			while (!release)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			done++;
+		}, 1, 2));
+
+	std::thread producer([&]() {
+		for (int i = 0; i < 20; ++i) {
+			p.push(i);
+			pushed++;
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	// one item in the last stage, two in its buffer, one pushing, two in the first buffer
+	EXPECT_LE(pushed, 6);
+	release = true;
+	producer.join();
+	p.drain();
+	EXPECT_EQ(done, 20);
+}
+
+TEST(PipelineTest, DestroyedWithBlockedStages) {
+	std::atomic<int> started{0};
+	{
+		ctq::pipeline p(
+			ctq::stage([](int n) { return n; }, 2, 1),
+			ctq::stage([&](int) {
+				started++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}, 1, 1));
+		for (int i = 0; i < 6; ++i)
+			p.push(i);
+	} // the first stage stops first: its workers finish their push, nothing deadlocks
+	EXPECT_GE(started, 1);
+}
+
+// ============================================================================
+// Inspection Tests
+// ============================================================================
+
+TEST(InspectionTest, SizeAndEmptyWithoutLock) {
+	ctq::basic_task_queue<std::deque<int>> queue(std::nullopt);
+	EXPECT_TRUE(queue.empty());
+	for (int i = 0; i < 5; ++i)
+		queue.push(i);
+	EXPECT_EQ(queue.size(), 5);
+	queue.try_pop();
+	std::vector<int> out;
+	queue.pop_batch(std::back_inserter(out), 2);
+	EXPECT_EQ(queue.size(), 2);
+	queue.access_queue([](auto& q) { q.clear(); });
+	EXPECT_TRUE(queue.empty());
+
+	ctq::task_queue<std::list, std::string> typed([](std::string) {}, 0);
+	typed.push("a");
+	typed.push("b");
+	EXPECT_EQ(typed.size(), 2);
+	EXPECT_FALSE(typed.empty());
+}
+
+TEST(InspectionTest, SnapshotCopiesInOrder) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(std::nullopt);
+	queue.push("a");
+	queue.push("b");
+	queue.push("c");
+	EXPECT_EQ(queue.snapshot(), (std::vector<std::string>{"a", "b", "c"}));
+	EXPECT_EQ(queue.size(), 3); // the items stay queued
+
+	ctq::task_queue<std::vector, int> typed([](int) {}, 0);
+	typed.push(7);
+	EXPECT_EQ(typed.snapshot(), std::vector<int>{7});
+}
+
+TEST(InspectionTest, SnapshotSkipsReservedSlots) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue(4);
+	queue.push(1);
+	auto s = queue.reserve();
+	*s = 2;
+	queue.push(3);
+	EXPECT_EQ(queue.snapshot(), (std::vector<int>{1, 3}));
+	s.commit();
+	EXPECT_EQ(queue.snapshot(), (std::vector<int>{1, 2, 3}));
+}
+
+TEST(InspectionTest, TemplatedAccessQueue) {
+	ctq::basic_task_queue<std::deque<int>> queue(std::nullopt);
+	queue.push(1);
+	queue.push(2);
+
+	// a move-only callable cannot be held by a std::function
+	auto sum = std::make_unique<int>(0);
+	queue.access_queue([&sum, owned = std::make_unique<int>(10)](auto& q) {
+		for (int v : q)
+			*sum += v + *owned;
+	});
+	EXPECT_EQ(*sum, 23);
+
+	const auto& view = queue;
+	size_t seen = 0;
+	view.access_queue([&seen](const auto& q) { seen = q.size(); });
+	EXPECT_EQ(seen, 2);
+
+	queue.access_queue([](auto& q) { q.push_back(3); });
+	EXPECT_EQ(queue.size(), 3);
+}
+
+TEST(InspectionTest, IdleWorkersAndSizeApprox) {
+	std::atomic<bool> release{false};
+	ctq::task_queue<std::deque, int> queue([&](int) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}, 3);
+	auto wait_idle = [&](size_t n) {
+		for (int i = 0; i < 1000 && queue.idle_workers() != n; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return queue.idle_workers();
+	};
+	EXPECT_EQ(wait_idle(3), 3);
+
+	queue.push(1);
+	EXPECT_EQ(wait_idle(2), 2);
+	queue.push(2);
+	queue.push(3);
+	queue.push(4);
+	EXPECT_EQ(wait_idle(0), 0);
+	EXPECT_EQ(queue.size_approx(), 1); // three taken by the workers
+
+	release = true;
+	EXPECT_EQ(wait_idle(3), 3);
+	EXPECT_EQ(queue.size_approx(), 0);
+
+	ctq::basic_task_queue<std::deque<int>> pull(std::nullopt);
+	EXPECT_EQ(pull.idle_workers(), 0);
+}
+
+// ============================================================================
+// Cancellation Tests
+// ============================================================================
+
+TEST(CancellationTest, CancelledItemsAreSkipped) {
+	ctq::basic_task_queue<std::vector<int>> queue(std::nullopt);
+	std::vector<ctq::ticket> tickets;
+	for (int i = 0; i < 6; ++i)
+		tickets.push_back(queue.push_cancellable(i));
+	EXPECT_TRUE(queue.cancel(tickets[1]));
+	EXPECT_TRUE(queue.cancel(tickets[2]));
+	EXPECT_TRUE(queue.cancel(tickets[5]));
+	EXPECT_FALSE(queue.cancel(tickets[5])); // already cancelled
+	EXPECT_EQ(queue.size(), 6); // tombstones stay until they reach the front
+
+	std::vector<int> out;
+	queue.pop_batch(std::back_inserter(out), 10);
+	EXPECT_EQ(out, (std::vector<int>{0, 3, 4}));
+	EXPECT_EQ(queue.cancelled(), 3);
+	EXPECT_TRUE(queue.empty());
+	EXPECT_FALSE(queue.cancel(tickets[0])); // already taken
+}
+
+TEST(CancellationTest, WorkersDoNotRunCancelledItems) {
+	std::atomic<bool> release{false};
+	std::mutex mutex;
+	std::vector<int> processed;
+	ctq::basic_task_queue<std::deque<int>> queue([&](int v) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		std::lock_guard lock(mutex);
+		processed.push_back(v);
+	}, std::nullopt, 1);
+
+	queue.push(0); // keeps the worker busy
+	while (queue.idle_workers() != 0 || queue.size() != 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::vector<ctq::ticket> tickets;
+	for (int i = 1; i <= 100; ++i)
+		tickets.push_back(queue.push_cancellable(i));
+	for (int i = 0; i < 100; ++i) {
+		if (i % 10 != 0) {
+			EXPECT_TRUE(queue.cancel(tickets[i]));
+		}
+	}
+	release = true;
+	while (queue.size() != 0 || queue.idle_workers() != 1)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::lock_guard lock(mutex);
+	EXPECT_EQ(processed, (std::vector<int>{0, 1, 11, 21, 31, 41, 51, 61, 71, 81, 91}));
+	EXPECT_EQ(queue.cancelled(), 90);
+}
+
+TEST(CancellationTest, CancellingTheFrontMakesRoom) {
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue(2);
+	auto first = queue.push_cancellable(1);
+	queue.push(2);
+
+	std::atomic<bool> pushed{false};
+	std::thread producer([&]() {
+		queue.push(3);
+		pushed = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_FALSE(pushed);
+	EXPECT_TRUE(queue.cancel(first));
+	producer.join();
+	EXPECT_EQ(queue.try_pop(), 2);
+	EXPECT_EQ(queue.try_pop(), 3);
+}
+
+TEST(CancellationTest, TicketsWithConflationAndAccessQueue) {
+	ctq::basic_task_queue<std::deque<std::pair<int, int>>> queue(std::nullopt);
+	queue.set_conflation([](const auto& p) { return p.first; });
+	auto a = queue.push_cancellable({1, 10});
+	auto merged = queue.push_cancellable({1, 11});
+	EXPECT_TRUE(a);
+	EXPECT_FALSE(merged); // folded into the queued item, nothing of its own to cancel
+	auto b = queue.push_cancellable({2, 20});
+	EXPECT_TRUE(queue.cancel(a));
+	EXPECT_EQ(queue.try_pop(), std::make_pair(2, 20));
+
+	// the key of the tombstone is free again
+	auto c = queue.push_cancellable({1, 12});
+	queue.access_queue([](auto&) {});
+	EXPECT_FALSE(queue.cancel(c)); // void after access_queue()
+	EXPECT_EQ(queue.try_pop(), std::make_pair(1, 12));
+	EXPECT_FALSE(queue.cancel(b));
+
+	ctq::basic_task_queue<ctq::circular_buffer<int>> ring(4);
+	ring.push_cancellable(1);
+	EXPECT_THROW(ring.reserve(), std::logic_error);
+}
+
+TEST(CancellationTest, CancelledKeyIsQueuedAgain) {
+	ctq::basic_task_queue<std::deque<std::pair<int, int>>> queue(std::nullopt);
+	queue.set_conflation([](const auto& p) { return p.first; });
+	queue.push({0, 0});
+	auto t = queue.push_cancellable({1, 10});
+	EXPECT_TRUE(queue.cancel(t)); // a tombstone behind the front
+	queue.push({1, 11}); // not merged into the tombstone
+	EXPECT_EQ(queue.conflated(), 0);
+
+	std::vector<std::pair<int, int>> items;
+	queue.pop_batch(std::back_inserter(items), 10);
+	EXPECT_EQ(items, (std::vector<std::pair<int, int>>{{0, 0}, {1, 11}}));
+	EXPECT_EQ(queue.cancelled(), 1);
+}
+
+// ============================================================================
+// Deadline Tests
+// ============================================================================
+
+TEST(DeadlineTest, WorkersSkipExpiredItems) {
+	std::atomic<bool> release{false};
+	std::mutex mutex;
+	std::vector<int> processed;
+	std::vector<int> expired;
+	ctq::task_queue<std::deque, int> queue([&](int v) {
+		while (!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		std::lock_guard lock(mutex);
+		processed.push_back(v);
+	}, 1);
+	queue.set_expiry([&](int& v) {
+		std::lock_guard lock(mutex);
+		expired.push_back(v);
+	});
+
+	queue.push(0); // keeps the worker busy while the deadlines pass
+	auto now = std::chrono::steady_clock::now();
+	queue.push(1, now + std::chrono::milliseconds(10));
+	queue.push(2, now + std::chrono::hours(1));
+	queue.push(3, now + std::chrono::milliseconds(10));
+	queue.push(4); // no deadline
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	release = true;
+	while (queue.size() != 0 || queue.idle_workers() != 1)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::lock_guard lock(mutex);
+	EXPECT_EQ(processed, (std::vector<int>{0, 2, 4}));
+	EXPECT_EQ(expired, (std::vector<int>{1, 3}));
+	EXPECT_EQ(queue.expired(), 2);
+}
+
+TEST(DeadlineTest, BacklogRecoversBySkipping) {
+	std::atomic<int> processed{0};
+	ctq::basic_task_queue<std::deque<int>> queue([&](int) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		processed++;
+	}, std::nullopt, 1);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+	for (int i = 0; i < 500; ++i)
+		queue.push(i, deadline);
+	auto start = std::chrono::steady_clock::now();
+	while (queue.size() != 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	// about 20 items run before the deadline, the rest is discarded without the 1ms each
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(400));
+	EXPECT_LT(processed, 100);
+	while (processed + queue.expired() < 500)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(processed + queue.expired(), 500);
+}
+
+TEST(DeadlineTest, SharedSchedulerAndPullMode) {
+	ctq::fair_scheduler pool(1);
+	std::atomic<int> processed{0};
+	ctq::basic_task_queue<std::deque<int>> scheduled([&](int) { processed++; }, std::nullopt, pool);
+	auto past = std::chrono::steady_clock::now() - std::chrono::milliseconds(1);
+	scheduled.push(1, past);
+	scheduled.push(2);
+	while (processed + scheduled.expired() < 2)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(processed, 1);
+	EXPECT_EQ(scheduled.expired(), 1);
+
+	// pull consumers get the item and decide for themselves
+	ctq::basic_task_queue<std::deque<int>> pull(std::nullopt);
+	pull.push(7, past);
+	EXPECT_EQ(pull.try_pop(), 7);
+	EXPECT_EQ(pull.expired(), 0);
+}
+
+// ============================================================================
+// Batching Tests
+// ============================================================================
+
+TEST(BatchingTest, PushBatchKeepsOrder) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(std::nullopt);
+	std::vector<std::string> items{"a", "b", "c"};
+	queue.push_batch(items.begin(), items.end());
+	EXPECT_EQ(queue.snapshot(), (std::vector<std::string>{"a", "b", "c"}));
+
+	std::atomic<int> sum{0};
+	ctq::task_queue<std::deque, int(int)> compute([&](int v) { sum += v; return v; }, 1);
+	std::vector<int> values{1, 2, 3, 4};
+	compute.push_batch(values.begin(), values.end());
+	while (sum < 10)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(sum, 10);
+}
+
+TEST(BatchingTest, PushBatchIntoFullQueue) {
+	std::atomic<int> processed{0};
+	ctq::basic_task_queue<ctq::circular_buffer<int>> queue([&](int) { processed++; }, 4, 1);
+	std::vector<int> items(100);
+	std::iota(items.begin(), items.end(), 0);
+	queue.push_batch(items.begin(), items.end()); // waits for the worker every 4 items
+	while (processed < 100)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(processed, 100);
+}
+
+TEST(BatchingTest, LocalBatcherFlushesBySize) {
+	ctq::basic_task_queue<std::deque<int>> queue(std::nullopt);
+	{
+		ctq::local_batcher batch(queue, 4);
+		for (int i = 0; i < 3; ++i)
+			batch.push(i);
+		EXPECT_EQ(queue.size(), 0);
+		EXPECT_EQ(batch.pending(), 3);
+		batch.push(3);
+		EXPECT_EQ(queue.size(), 4);
+		EXPECT_EQ(batch.pending(), 0);
+		batch.emplace(4);
+		batch.flush();
+		EXPECT_EQ(queue.size(), 5);
+		batch.push(5);
+	} // flushed by the destructor
+	EXPECT_EQ(queue.snapshot(), (std::vector<int>{0, 1, 2, 3, 4, 5}));
+}
+
+TEST(BatchingTest, LocalBatcherFlushesByDelay) {
+	ctq::task_queue<std::deque, int> queue([](int) {}, 0);
+	ctq::local_batcher batch(queue, 1000, std::chrono::milliseconds(10));
+	batch.push(1);
+	batch.push(2);
+	EXPECT_EQ(queue.size(), 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(15));
+	batch.push(3); // the oldest item is past the delay
+	EXPECT_EQ(queue.size(), 3);
+}
+
+TEST(BatchingTest, ProducersWithOwnBatchers) {
+	std::atomic<int> processed{0};
+	ctq::task_queue<std::deque, int> queue([&](int) { processed++; }, 2);
+	std::vector<std::thread> producers;
+	for (int p = 0; p < 4; ++p) {
+		producers.emplace_back([&queue, p]() {
+			ctq::local_batcher batch(queue, 8 * (p + 1));
+			for (int i = 0; i < 1000; ++i)
+				batch.push(i);
+		});
+	}
+	for (auto& t : producers)
+		t.join();
+	while (processed < 4000)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(processed, 4000);
+}
+
+// ============================================================================
+// Spill Tests
+// ============================================================================
+
+#if defined(__linux__)
+namespace {
+
+ctq::spill_codec<std::string> string_codec() {
+	return {
+		[](const std::string& s, std::vector<std::byte>& out) {
+			auto p = reinterpret_cast<const std::byte*>(s.data());
+			out.insert(out.end(), p, p + s.size());
+		},
+		[](std::span<const std::byte> in) {
+			return std::string(reinterpret_cast<const char*>(in.data()), in.size());
+		}
+	};
+}
+
+} // namespace
+
+TEST(SpillTest, FullQueueSpillsInsteadOfBlocking) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(4);
+	queue.set_spill(std::filesystem::temp_directory_path(), string_codec());
+	for (int i = 0; i < 100; ++i)
+		queue.push(std::to_string(i)); // would block at the fifth item otherwise
+	EXPECT_EQ(queue.size(), 100);
+	EXPECT_EQ(queue.spilled(), 96);
+	EXPECT_EQ(queue.snapshot().back(), "99");
+
+	for (int i = 0; i < 100; ++i)
+		EXPECT_EQ(queue.pop(), std::to_string(i));
+	EXPECT_EQ(queue.spilled(), 0);
+	EXPECT_TRUE(queue.empty());
+
+	queue.push("again"); // room in memory, the spill file is empty
+	EXPECT_EQ(queue.spilled(), 0);
+	EXPECT_EQ(queue.pop(), "again");
+}
+
+TEST(SpillTest, WorkersDrainSegmentsInOrder) {
+	std::vector<std::string> seen;
+	std::mutex m;
+	std::atomic<bool> go{false};
+	ctq::basic_task_queue<ctq::circular_buffer<std::string>> queue(
+		[&](std::string s) {
+			go.wait(false);
+			std::lock_guard lock(m);
+			seen.push_back(std::move(s));
+		},
+		8, 1);
+	// segments of 64 bytes hold a few items each, the large one gets its own
+	queue.set_spill(std::filesystem::temp_directory_path(), string_codec(), 64);
+	std::vector<std::string> pushed;
+	for (int i = 0; i < 500; ++i)
+		pushed.push_back(i == 250 ? std::string(1000, 'x') : "item " + std::to_string(i));
+	for (auto& s : pushed)
+		queue.push(s);
+	EXPECT_GT(queue.spilled(), 0);
+	go = true;
+	go.notify_all();
+	auto processed = [&]() { std::lock_guard lock(m); return seen.size(); };
+	while (processed() < pushed.size())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_EQ(queue.spilled(), 0);
+	std::lock_guard lock(m);
+	EXPECT_EQ(seen, pushed);
+}
+
+TEST(SpillTest, CancelSpilledItem) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(2);
+	queue.set_spill(std::filesystem::temp_directory_path(), string_codec());
+	std::vector<ctq::ticket> tickets;
+	for (int i = 0; i < 6; ++i)
+		tickets.push_back(queue.push_cancellable(std::to_string(i)));
+	EXPECT_TRUE(queue.cancel(tickets[3])); // on disk
+	EXPECT_TRUE(queue.cancel(tickets[2]));
+
+	std::vector<std::string> popped;
+	while (auto s = queue.try_pop())
+		popped.push_back(*s);
+	EXPECT_EQ(popped, (std::vector<std::string>{"0", "1", "4", "5"}));
+	EXPECT_EQ(queue.cancelled(), 2);
+}
+
+TEST(SpillTest, TryPushSpills) {
+	ctq::basic_task_queue<std::deque<std::string>> queue(1);
+	queue.set_spill(std::filesystem::temp_directory_path(), string_codec());
+	std::string a = "a", b = "b";
+	EXPECT_TRUE(queue.try_push(std::move(a)));
+	EXPECT_TRUE(queue.try_push(std::move(b)));
+	EXPECT_EQ(queue.spilled(), 1);
+	EXPECT_EQ(queue.snapshot(), (std::vector<std::string>{"a", "b"}));
+}
+
+TEST(SpillTest, RejectsUnsupportedSetups) {
+	ctq::basic_task_queue<std::deque<std::string>> unbounded(std::nullopt);
+	EXPECT_THROW(unbounded.set_spill(std::filesystem::temp_directory_path(), string_codec()), std::invalid_argument);
+
+	ctq::basic_task_queue<std::deque<std::string>> queue(4);
+	queue.set_spill(std::filesystem::temp_directory_path(), string_codec());
+	EXPECT_THROW(queue.set_conflation([](const std::string& s) { return s; }), std::logic_error);
+
+	ctq::basic_task_queue<std::deque<std::string>> nonempty(4);
+	nonempty.push("x");
+	EXPECT_THROW(nonempty.set_spill(std::filesystem::temp_directory_path(), string_codec()), std::logic_error);
+
+	ctq::basic_task_queue<std::deque<std::string>> missing(1);
+	missing.set_spill("/nonexistent/ctq", string_codec());
+	missing.push("fits in memory");
+	EXPECT_THROW(missing.push("spilled"), std::system_error);
+}
+#endif
+
+// ============================================================================
+// Durable Queue Tests
+// ============================================================================
+
+#if defined(__linux__)
+namespace {
+
+// a fresh log directory per test, removed afterwards
+struct wal_dir {
+	std::filesystem::path path;
+
+	explicit wal_dir(const char* name)
+		: path(std::filesystem::temp_directory_path() / name)
+	{
+		std::filesystem::remove_all(path);
+	}
+
+	~wal_dir() {
+		std::filesystem::remove_all(path);
+	}
+
+	size_t segments() const {
+		size_t n = 0;
+		for (auto& e : std::filesystem::directory_iterator(path))
+			n += e.path().extension() == ".log";
+		return n;
+	}
+};
+
+// collects the processed items
+struct recorder {
+	std::mutex m;
+	std::vector<std::string> seen;
+
+	void operator()(std::string s) {
+		std::lock_guard lock(m);
+		seen.push_back(std::move(s));
+	}
+
+	std::vector<std::string> wait_for(size_t n) {
+		for (;;) {
+			{
+				std::lock_guard lock(m);
+				if (seen.size() >= n)
+					return seen;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+};
+
+} // namespace
+
+TEST(DurableQueueTest, ReplaysQueuedItemsAfterRestart) {
+	wal_dir dir("ctq-wal-replay");
+	{
+		// no workers: everything is still queued when the queue goes away
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+		for (int i = 0; i < 10; ++i)
+			queue.push(std::to_string(i));
+		EXPECT_EQ(queue.checkpoint(), 0);
+	}
+	recorder r;
+	ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+	EXPECT_EQ(queue.replayed(), 10);
+	EXPECT_EQ(r.wait_for(10), (std::vector<std::string>{"0", "1", "2", "3", "4", "5", "6", "7", "8", "9"}));
+}
+
+TEST(DurableQueueTest, AcknowledgedItemsAreNotReplayed) {
+	wal_dir dir("ctq-wal-ack");
+	{
+		recorder r;
+		ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+		for (int i = 0; i < 5; ++i)
+			queue.push(std::to_string(i));
+		r.wait_for(5);
+		while (queue.checkpoint() < 5)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	{
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+		EXPECT_EQ(queue.replayed(), 0);
+		std::vector<std::string> batch{"5", "6", "7"};
+		queue.push_batch(batch.begin(), batch.end());
+	}
+	recorder r;
+	ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+	EXPECT_EQ(queue.replayed(), 3);
+	EXPECT_EQ(r.wait_for(3), (std::vector<std::string>{"5", "6", "7"}));
+	while (queue.checkpoint() < 8)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+TEST(DurableQueueTest, ConcurrentProducersAndSegmentCleanup) {
+	wal_dir dir("ctq-wal-concurrent");
+	recorder r;
+	// small segments, so that many are created and deleted behind the checkpoint
+	ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec(), 16, 2, 256);
+	std::vector<std::thread> producers;
+	for (int p = 0; p < 4; ++p) {
+		producers.emplace_back([&queue, p]() {
+			for (int i = 0; i < 100; ++i)
+				queue.push(std::to_string(p) + ":" + std::to_string(i));
+		});
+	}
+	for (auto& t : producers)
+		t.join();
+	EXPECT_EQ(r.wait_for(400).size(), 400);
+	while (queue.checkpoint() < 400)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	EXPECT_LE(dir.segments(), 2);
+}
+
+TEST(DurableQueueTest, TornRecordEndsReplay) {
+	wal_dir dir("ctq-wal-torn");
+	{
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+		queue.push("a");
+		queue.push("b");
+		queue.push("c");
+	}
+	// corrupt the payload of the last record, as a write cut short by a crash would
+	ASSERT_EQ(dir.segments(), 1);
+	for (auto& e : std::filesystem::directory_iterator(dir.path)) {
+		if (e.path().extension() != ".log")
+			continue;
+		std::fstream f(e.path(), std::ios::in | std::ios::out | std::ios::binary);
+		f.seekp(2 * 17 + 16); // two records of a 16 byte header and 1 byte, then a header
+		f.put('x');
+	}
+	{
+		recorder r;
+		ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+		EXPECT_EQ(queue.replayed(), 2);
+		EXPECT_EQ(r.wait_for(2), (std::vector<std::string>{"a", "b"}));
+		queue.push("d"); // numbered like the torn record, in a new segment
+		EXPECT_EQ(r.wait_for(3).back(), "d");
+		while (queue.checkpoint() < 3)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+	EXPECT_EQ(queue.replayed(), 0);
+}
+
+namespace {
+
+// overwrite one byte of a log segment, as a write cut short by a crash would leave it
+void corrupt(const std::filesystem::path& dir, const char* segment, std::streamoff at) {
+	std::fstream f(dir / segment, std::ios::in | std::ios::out | std::ios::binary);
+	ASSERT_TRUE(f.is_open());
+	f.seekp(at);
+	f.put('x');
+}
+
+} // namespace
+
+TEST(DurableQueueTest, SegmentWithoutValidRecordIsDeleted) {
+	wal_dir dir("ctq-wal-empty");
+	{
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+		queue.push("a");
+	}
+	corrupt(dir.path, "wal-00000000000000000000.log", 16); // the payload of the only record
+	{
+		recorder r;
+		ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+		EXPECT_EQ(queue.replayed(), 0);
+		EXPECT_EQ(dir.segments(), 0);
+		// the next segment takes the name of the deleted one, and survives the checkpoint
+		queue.push("b");
+		r.wait_for(1);
+		while (queue.checkpoint() < 1)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		EXPECT_EQ(dir.segments(), 1);
+	}
+	{
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+		queue.push("c");
+	}
+	recorder r;
+	ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+	EXPECT_EQ(queue.replayed(), 1);
+	EXPECT_EQ(r.wait_for(1), std::vector<std::string>{"c"});
+}
+
+TEST(DurableQueueTest, GapBetweenSegmentsEndsReplay) {
+	wal_dir dir("ctq-wal-gap");
+	{
+		// records of 17 bytes, three per segment
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0, 64);
+		for (auto s : {"a", "b", "c", "d", "e", "f"})
+			queue.push(s);
+	}
+	ASSERT_EQ(dir.segments(), 2);
+	corrupt(dir.path, "wal-00000000000000000000.log", 17 + 16); // record 1, "b"
+	{
+		recorder r;
+		ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec(), std::nullopt, 1, 64);
+		EXPECT_EQ(queue.replayed(), 1); // not "d" to "f", behind the torn record
+		EXPECT_EQ(dir.segments(), 1);
+		queue.push("x"); // numbered 1, right after "a"
+		EXPECT_EQ(r.wait_for(2), (std::vector<std::string>{"a", "x"}));
+		while (queue.checkpoint() < 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0, 64);
+	EXPECT_EQ(queue.replayed(), 0);
+}
+
+TEST(DurableQueueTest, CheckpointBehindTheLogMovesOn) {
+	wal_dir dir("ctq-wal-behind");
+	{
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0, 64);
+		for (auto s : {"a", "b", "c", "d", "e", "f"})
+			queue.push(s);
+	}
+	// the checkpoint on disk is 0, below the first record left
+	std::filesystem::remove(dir.path / "wal-00000000000000000000.log");
+	{
+		recorder r;
+		ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec(), std::nullopt, 1, 64);
+		EXPECT_EQ(queue.checkpoint(), 3);
+		EXPECT_EQ(r.wait_for(3), (std::vector<std::string>{"d", "e", "f"}));
+		while (queue.checkpoint() < 6)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0, 64);
+	EXPECT_EQ(queue.replayed(), 0);
+}
+
+TEST(DurableQueueTest, ForeignLogFilesAreLeftAlone) {
+	wal_dir dir("ctq-wal-foreign");
+	{
+		ctq::durable_queue<std::string> queue([](std::string) {}, dir.path, string_codec(), std::nullopt, 0);
+		queue.push("a");
+	}
+	for (auto name : {"wal-x.log", "wal-.log", "wal-0000000000000000000x.log", "wal-99999999999999999999.log"})
+		std::ofstream(dir.path / name) << "not a segment";
+	recorder r;
+	ctq::durable_queue<std::string> queue(std::ref(r), dir.path, string_codec());
+	EXPECT_EQ(queue.replayed(), 1);
+	EXPECT_EQ(r.wait_for(1), std::vector<std::string>{"a"});
+	EXPECT_TRUE(std::filesystem::exists(dir.path / "wal-x.log"));
+	EXPECT_TRUE(std::filesystem::exists(dir.path / "wal-99999999999999999999.log"));
+}
+#endif
+
 // ============================================================================
 // Main
 // ============================================================================